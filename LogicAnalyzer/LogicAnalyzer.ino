@@ -30,36 +30,41 @@
 #include "tla.h"
 #include "insn_decode.h"
 
-// Maximum buffer size (in samples). Increase if needed; should be
-// able to go up to at least 30,000 before running out of memory.
+// Maximum buffer size (in samples).  Each sample takes 16.5 bytes of
+// RAM1 (control, address, data, recordInfo and cycles), which it shares
+// with the memory image and the other tables; check the linker's RAM1
+// figure before increasing it.
 #define BUFFSIZE 5000
 
 const char *versionString = "Teensy Logic Analyzer version 0.4";
 const char *verboseVersionStringAdditions = " by Jason R. Thorpe <thorpej@me.com>";
 const char *origVersionString = "Based on Logic Analyzer version 0.30 by Jeff Tranter <tranter@pobox.com>";
 
-#define cpu_has_iospace(c)  ((c) == cpu_z80)
-
 // Global variables
 uint32_t control[BUFFSIZE];           // Recorded control line data
 uint32_t address[BUFFSIZE];           // Recorded address data
 uint32_t data[BUFFSIZE];              // Recorded data lines
+uint8_t cycles[(BUFFSIZE + 1) / 2];   // Bus cycle types, 4 bits per sample
+uint32_t recordInfo[BUFFSIZE];        // Trace/write log record info (see captureMode)
 uint32_t triggerAddress = 0;          // Address to trigger on
+uint32_t triggerAddressMask = 0xffff; // Address bits that must match
 uint32_t triggerData = 0;             // Data to trigger on
-uint32_t aTriggerBits;                // GPIO bit pattern to trigger address on
-uint32_t aTriggerMask;                // bitmask of GPIO address bits
-uint32_t cTriggerBits;                // GPIO bit pattern to trigger control on
-uint32_t cTriggerMask;                // bitmask of GPIO control bits
-uint32_t dTriggerBits;                // GPIO bit pattern to trigger data on
-uint32_t dTriggerMask;                // bitmask of GPIO data bits
+uint32_t triggerDataMask = 0xff;      // Data bits that must match
 int samples = 20;                     // Total number of samples to record (up to BUFFSIZE)
 int pretrigger = 0;                   // Number of samples to record before trigger (up to samples)
 int triggerPoint = 0;                 // Sample in buffer corresponding to trigger point
 int samplesTaken = 0;                 // Number of samples taken
+int recordsStored = 0;                // Buffer slots written by a compressed capture
+capture_mode_t captureMode = cm_samples; // What the buffer holds
+uint32_t triggerCyccnt;               // ARM_DWT_CYCCNT when the trigger was seen
+uint32_t captureCyccnt;               // ARM_DWT_CYCCNT when the buffer was full
+uint32_t triggerMicros;               // micros() when the trigger was seen
 trigger_t triggerMode = tr_none;      // Type of trigger
 cycle_t triggerCycle = tr_either;     // Trigger on read, write, or either
 space_t triggerSpace = tr_mem;        // default to memory space
 bool triggerLevel = false;            // Trigger level (false=low, true=high);
+trigger_out_t triggerOut = to_off;    // Trigger out pin polarity
+uint32_t triggerOutLatency;           // CPU cycles from detecting the trigger to trigger out
 volatile bool triggerPressed = false; // Set by hardware trigger button
 
 extern "C" {
@@ -85,6 +90,34 @@ extern "C" {
   }
 }
 
+#if defined(TLA_PERF)
+extern "C" {
+  struct perf_counter perf_counters[pf_count];
+
+  // The cycle counter wraps every 7 seconds at 600 MHz, so nothing timed
+  // with it can take longer than that.
+  uint32_t
+  perf_cycles(void)
+  {
+    return ARM_DWT_CYCCNT;
+  }
+
+  void
+  perf_end(perf_t p, uint32_t start, uint32_t items)
+  {
+    struct perf_counter *pc = &perf_counters[p];
+    uint32_t t = ARM_DWT_CYCCNT - start;
+
+    pc->calls++;
+    pc->cycles += t;
+    pc->items += items;
+    if (t > pc->max) {
+      pc->max = t;
+    }
+  }
+}
+#endif // TLA_PERF
+
 void
 show_version(bool verbose)
 {
@@ -131,7 +164,7 @@ show_version(bool verbose)
 // 27 (1.31) - CA15
 // 28 (3.18) -- data bus enable
 // 29 (4.31) - CC4
-// 30 (3.23) - n/c
+// 30 (3.23) -- trigger out
 // 31 (3.22) -- trigger button
 // 32 (2.12) - CD7
 // 33 (4.7)  - CC5
@@ -153,64 +186,48 @@ show_version(bool verbose)
 // (2 pins will always be taken up by Vcc and GND).
 
 #define ENABLE_PIN        28
+#define TRIGGER_OUT_PIN   30
 #define BUTTON_PIN        31
 
-#define CAxx_PSR          CORE_PIN0_PINREG   // All CAxx lines are in the same GPIO port
-#define CA0_PIN_BITMASK   CORE_PIN0_BITMASK
-#define CA1_PIN_BITMASK   CORE_PIN1_BITMASK
-#define CA2_PIN_BITMASK   CORE_PIN14_BITMASK
-#define CA3_PIN_BITMASK   CORE_PIN15_BITMASK
-#define CA4_PIN_BITMASK   CORE_PIN16_BITMASK
-#define CA5_PIN_BITMASK   CORE_PIN17_BITMASK
-#define CA6_PIN_BITMASK   CORE_PIN18_BITMASK
-#define CA7_PIN_BITMASK   CORE_PIN19_BITMASK
-#define CA8_PIN_BITMASK   CORE_PIN20_BITMASK
-#define CA9_PIN_BITMASK   CORE_PIN21_BITMASK
-#define CA10_PIN_BITMASK  CORE_PIN22_BITMASK
-#define CA11_PIN_BITMASK  CORE_PIN23_BITMASK
-#define CA12_PIN_BITMASK  CORE_PIN24_BITMASK
-#define CA13_PIN_BITMASK  CORE_PIN25_BITMASK
-#define CA14_PIN_BITMASK  CORE_PIN26_BITMASK
-#define CA15_PIN_BITMASK  CORE_PIN27_BITMASK
-
-#define CDxx_PSR          CORE_PIN6_PINREG    // All CDxx lines are in the same GPIO port  
-#define CD0_PIN_BITMASK   CORE_PIN6_BITMASK
-#define CD1_PIN_BITMASK   CORE_PIN7_BITMASK
-#define CD2_PIN_BITMASK   CORE_PIN8_BITMASK
-#define CD3_PIN_BITMASK   CORE_PIN9_BITMASK
-#define CD4_PIN_BITMASK   CORE_PIN10_BITMASK
-#define CD5_PIN_BITMASK   CORE_PIN11_BITMASK
-#define CD6_PIN_BITMASK   CORE_PIN12_BITMASK
-#define CD7_PIN_BITMASK   CORE_PIN32_BITMASK
-
-// Control signals are grouped into physical inputs (CCxx_PIN_BITMASK),
-// and their logical equivalents (CCxx_BITMASK).  The logical equivalants,
-// once normalized re then grouped into their per-CPU meanings (CC_xxx_yyy).
-
-#define CCxx_PSR          CORE_PIN2_PINREG
-#define CC0_PIN_BITMASK   CORE_PIN2_BITMASK
-#define CC1_PIN_BITMASK   CORE_PIN3_BITMASK
-#define CC2_PIN_BITMASK   CORE_PIN4_BITMASK
-#define CC3_PIN_BITMASK   CORE_PIN5_BITMASK
-#define CC4_PIN_BITMASK   CORE_PIN29_BITMASK
-#define CC5_PIN_BITMASK   CORE_PIN33_BITMASK
-#define CC6_PIN_BITMASK   CORE_PIN38_BITMASK  // in CAxx_PSR
-#define CC7_PIN_BITMASK   CORE_PIN34_BITMASK  // in CDxx_PSR
-#define CC8_PIN_BITMASK   CORE_PIN35_BITMASK  // in CDxx_PSR
-#define CC9_PIN_BITMASK   CORE_PIN36_BITMASK  // in CDxx_PSR
-#define CC10_PIN_BITMASK  CORE_PIN37_BITMASK  // in CDxx_PSR
-#define CC11_PIN_BITMASK  CORE_PIN39_BITMASK  // in CAxx_PSR
-#define CC12_PIN_BITMASK  CORE_PIN40_BITMASK  // in CAxx_PSR
-#define CC13_PIN_BITMASK  CORE_PIN41_BITMASK  // in CAxx_PSR
-
-// The control signals in CDxx_PSR need to be read at the same time as the
-// other control signals, which means we need to read the CDxx_PSR twice
-// and properly mix the bits from the each read into the final result.
-#define CDxx_PSR_CC_MASK  (CC7_PIN_BITMASK | CC8_PIN_BITMASK | CC9_PIN_BITMASK | CC10_PIN_BITMASK)
-#define CDxx_PSR_CD_MASK  (~CDxx_PSR_CC_MASK)
+//
+// PIN MAP.  This is the one place where the routing of the probed signals
+// to the Teensy's digital I/O pins is described.  Everything else -- which
+// GPIO port register each group of signals lives in, the raw port bitmasks,
+// and the scramble / unscramble kernels that convert between the logical
+// signal layout and the raw port layout -- is derived from these at compile
+// time.  A board revision with different routing only needs to change this
+// table (and the master table comment above).
+//
+// The CAxx lines must all be in the same GPIO port, as must the CDxx lines.
+// The CCxx lines may be spread across any of the three ports; the kernels
+// below will pick the bits out of the correct register.
+//
+#define CA0_PIN           0
+#define CA1_PIN           1
+#define CA2_PIN           14
+#define CA3_PIN           15
+#define CA4_PIN           16
+#define CA5_PIN           17
+#define CA6_PIN           18
+#define CA7_PIN           19
+#define CA8_PIN           20
+#define CA9_PIN           21
+#define CA10_PIN          22
+#define CA11_PIN          23
+#define CA12_PIN          24
+#define CA13_PIN          25
+#define CA14_PIN          26
+#define CA15_PIN          27
+
+#define CD0_PIN           6
+#define CD1_PIN           7
+#define CD2_PIN           8
+#define CD3_PIN           9
+#define CD4_PIN           10
+#define CD5_PIN           11
+#define CD6_PIN           12
+#define CD7_PIN           32
 
-// We need to poll certain CC pins, so define constants for
-// them here.
 #define CC0_PIN           2
 #define CC1_PIN           3
 #define CC2_PIN           4
@@ -226,6 +243,41 @@ show_version(bool verbose)
 #define CC12_PIN          40
 #define CC13_PIN          41
 
+// Iterators over the logical signals in each group.  These don't depend
+// on the board routing.
+#define FOREACH_CA(X)     X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7) \
+                          X(8) X(9) X(10) X(11) X(12) X(13) X(14) X(15)
+#define FOREACH_CD(X)     X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7)
+#define FOREACH_CC(X)     X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7) \
+                          X(8) X(9) X(10) X(11) X(12) X(13)
+
+// Map a Teensy pin number to its GPIO port register and its bit within
+// that register.  The extra level of indirection is so that the pin number
+// macros above get expanded before pasting.
+#define PIN_BIT(p)        PIN_BIT_(p)
+#define PIN_BIT_(p)       CORE_PIN ## p ## _BIT
+#define PIN_BITMASK(p)    PIN_BITMASK_(p)
+#define PIN_BITMASK_(p)   CORE_PIN ## p ## _BITMASK
+#define PIN_PSR(p)        PIN_PSR_(p)
+#define PIN_PSR_(p)       CORE_PIN ## p ## _PINREG
+
+// True if pin p is read through GPIO port register psr.  The register
+// addresses are constants, so this folds away at compile time.
+#define PIN_IN_PSR(p, psr) (&PIN_PSR(p) == &(psr))
+
+#define CAxx_PSR          PIN_PSR(CA0_PIN)   // All CAxx lines are in the same GPIO port
+#define CDxx_PSR          PIN_PSR(CD0_PIN)   // All CDxx lines are in the same GPIO port
+#define CCxx_PSR          PIN_PSR(CC0_PIN)
+
+// Select which of the three port values holds control signal CCn.
+#define CC_PSR_SELECT(n, creg, areg, dreg)                      \
+  (PIN_IN_PSR(CC ## n ## _PIN, CAxx_PSR) ? (areg) :             \
+   PIN_IN_PSR(CC ## n ## _PIN, CDxx_PSR) ? (dreg) : (creg))
+
+// Control signals are grouped into physical inputs (CCn_PIN), and their
+// logical equivalents (CCn_BITMASK).  The logical equivalants, once
+// normalized are then grouped into their per-CPU meanings (CC_xxx_yyy).
+
 #define CC0_BITMASK       (1U <<  0)
 #define CC1_BITMASK       (1U <<  1)
 #define CC2_BITMASK       (1U <<  2)
@@ -316,148 +368,101 @@ show_version(bool verbose)
 //
 #include "test_samples.h"
 
-// Macros to await signal transitions.
-#define WAIT_PHI2_LOW while (digitalReadFast(CC_6502_PHI2_PIN) == HIGH) ;
-#define WAIT_PHI2_HIGH while (digitalReadFast(CC_6502_PHI2_PIN) == LOW) ;
-#define WAIT_Q_LOW while (digitalReadFast(CC_6809_Q) == HIGH) ;
-#define WAIT_Q_HIGH while (digitalReadFast(CC_6809_Q) == LOW) ;
-#define WAIT_E_LOW while (digitalReadFast(CC_6809_E) == HIGH) ;
-#define WAIT_E_HIGH while (digitalReadFast(CC_6809_E) == LOW) ;
-#define WAIT_CLK_LOW while (digitalReadFast(CC_Z80_CLK_PIN) == HIGH) ;
-#define WAIT_CLK_HIGH while (digitalReadFast(CC_Z80_CLK_PIN) == LOW) ;
-
+//
+// Scramble / unscramble kernels.  These are generated from the pin map
+// above, one term per signal, so each is straight-line code specialized
+// for the exact bit layout of the board.
+//
 uint32_t
 scramble_CAxx(uint32_t ca)
 {
-  return ((ca & (1U <<  0)) ?  CA0_PIN_BITMASK : 0) |
-         ((ca & (1U <<  1)) ?  CA1_PIN_BITMASK : 0) |
-         ((ca & (1U <<  2)) ?  CA2_PIN_BITMASK : 0) |
-         ((ca & (1U <<  3)) ?  CA3_PIN_BITMASK : 0) |
-         ((ca & (1U <<  4)) ?  CA4_PIN_BITMASK : 0) |
-         ((ca & (1U <<  5)) ?  CA5_PIN_BITMASK : 0) |
-         ((ca & (1U <<  6)) ?  CA6_PIN_BITMASK : 0) |
-         ((ca & (1U <<  7)) ?  CA7_PIN_BITMASK : 0) |
-         ((ca & (1U <<  8)) ?  CA8_PIN_BITMASK : 0) |
-         ((ca & (1U <<  9)) ?  CA9_PIN_BITMASK : 0) |
-         ((ca & (1U << 10)) ? CA10_PIN_BITMASK : 0) |
-         ((ca & (1U << 11)) ? CA11_PIN_BITMASK : 0) |
-         ((ca & (1U << 12)) ? CA12_PIN_BITMASK : 0) |
-         ((ca & (1U << 13)) ? CA13_PIN_BITMASK : 0) |
-         ((ca & (1U << 14)) ? CA14_PIN_BITMASK : 0) |
-         ((ca & (1U << 15)) ? CA15_PIN_BITMASK : 0);
+  uint32_t reg = 0;
+#define X(n)  reg |= ((ca >> (n)) & 1U) << PIN_BIT(CA ## n ## _PIN);
+  FOREACH_CA(X)
+#undef X
+  return reg;
 }
 
 uint32_t
 unscramble_CAxx(uint32_t reg)
 {
-  return ((reg &  CA0_PIN_BITMASK) ? (1U <<  0) : 0) |
-         ((reg &  CA1_PIN_BITMASK) ? (1U <<  1) : 0) |
-         ((reg &  CA2_PIN_BITMASK) ? (1U <<  2) : 0) |
-         ((reg &  CA3_PIN_BITMASK) ? (1U <<  3) : 0) |
-         ((reg &  CA4_PIN_BITMASK) ? (1U <<  4) : 0) |
-         ((reg &  CA5_PIN_BITMASK) ? (1U <<  5) : 0) |
-         ((reg &  CA6_PIN_BITMASK) ? (1U <<  6) : 0) |
-         ((reg &  CA7_PIN_BITMASK) ? (1U <<  7) : 0) |
-         ((reg &  CA8_PIN_BITMASK) ? (1U <<  8) : 0) |
-         ((reg &  CA9_PIN_BITMASK) ? (1U <<  9) : 0) |
-         ((reg & CA10_PIN_BITMASK) ? (1U << 10) : 0) |
-         ((reg & CA11_PIN_BITMASK) ? (1U << 11) : 0) |
-         ((reg & CA12_PIN_BITMASK) ? (1U << 12) : 0) |
-         ((reg & CA13_PIN_BITMASK) ? (1U << 13) : 0) |
-         ((reg & CA14_PIN_BITMASK) ? (1U << 14) : 0) |
-         ((reg & CA15_PIN_BITMASK) ? (1U << 15) : 0);
+  uint32_t ca = 0;
+#define X(n)  ca |= ((reg >> PIN_BIT(CA ## n ## _PIN)) & 1U) << (n);
+  FOREACH_CA(X)
+#undef X
+  return ca;
 }
 
 uint32_t
 scramble_CDxx(uint32_t cd)
 {
-    return ((cd & (1U << 0)) ? CD0_PIN_BITMASK : 0) |
-           ((cd & (1U << 1)) ? CD1_PIN_BITMASK : 0) |
-           ((cd & (1U << 2)) ? CD2_PIN_BITMASK : 0) |
-           ((cd & (1U << 3)) ? CD3_PIN_BITMASK : 0) |
-           ((cd & (1U << 4)) ? CD4_PIN_BITMASK : 0) |
-           ((cd & (1U << 5)) ? CD5_PIN_BITMASK : 0) |
-           ((cd & (1U << 6)) ? CD6_PIN_BITMASK : 0) |
-           ((cd & (1U << 7)) ? CD7_PIN_BITMASK : 0);
+  uint32_t reg = 0;
+#define X(n)  reg |= ((cd >> (n)) & 1U) << PIN_BIT(CD ## n ## _PIN);
+  FOREACH_CD(X)
+#undef X
+  return reg;
 }
 
 uint32_t
 unscramble_CDxx(uint32_t reg)
 {
-  return ((reg & CD0_PIN_BITMASK) ? (1U << 0) : 0) |
-         ((reg & CD1_PIN_BITMASK) ? (1U << 1) : 0) |
-         ((reg & CD2_PIN_BITMASK) ? (1U << 2) : 0) |
-         ((reg & CD3_PIN_BITMASK) ? (1U << 3) : 0) |
-         ((reg & CD4_PIN_BITMASK) ? (1U << 4) : 0) |
-         ((reg & CD5_PIN_BITMASK) ? (1U << 5) : 0) |
-         ((reg & CD6_PIN_BITMASK) ? (1U << 6) : 0) |
-         ((reg & CD7_PIN_BITMASK) ? (1U << 7) : 0);
+  uint32_t cd = 0;
+#define X(n)  cd |= ((reg >> PIN_BIT(CD ## n ## _PIN)) & 1U) << (n);
+  FOREACH_CD(X)
+#undef X
+  return cd;
 }
 
+// Some control signals live in the CAxx and CDxx ports; those bits get
+// OR'd into *aregp and *dregp, respectively.  The bits that live in the
+// CCxx port are returned.
 uint32_t
 scramble_CCxx(uint32_t cc, uint32_t *aregp, uint32_t *dregp)
 {
-  if (cc & CC6_BITMASK) {
-    *aregp |= CC6_PIN_BITMASK;
-  }
-  if (cc & CC11_BITMASK) {
-    *aregp |= CC11_PIN_BITMASK;
-  }
-  if (cc & CC12_BITMASK) {
-    *aregp |= CC12_PIN_BITMASK;
-  }
-  if (cc & CC13_BITMASK) {
-    *aregp |= CC13_PIN_BITMASK;
-  }
-
-  if (cc & CC7_BITMASK) {
-    *dregp |= CC7_PIN_BITMASK;
-  }
-  if (cc & CC8_BITMASK) {
-    *dregp |= CC8_PIN_BITMASK;
-  }
-  if (cc & CC9_BITMASK) {
-    *dregp |= CC9_PIN_BITMASK;
-  }
-  if (cc & CC10_BITMASK) {
-    *dregp |= CC10_PIN_BITMASK;
-  }
-
-  return ((cc & CC0_BITMASK) ? CC0_PIN_BITMASK : 0) |
-         ((cc & CC1_BITMASK) ? CC1_PIN_BITMASK : 0) |
-         ((cc & CC2_BITMASK) ? CC2_PIN_BITMASK : 0) |
-         ((cc & CC3_BITMASK) ? CC3_PIN_BITMASK : 0) |
-         ((cc & CC4_BITMASK) ? CC4_PIN_BITMASK : 0) |
-         ((cc & CC5_BITMASK) ? CC5_PIN_BITMASK : 0);
+  uint32_t creg = 0;
+#define X(n)  *CC_PSR_SELECT(n, &creg, aregp, dregp) |=                     \
+                ((cc >> (n)) & 1U) << PIN_BIT(CC ## n ## _PIN);
+  FOREACH_CC(X)
+#undef X
+  return creg;
 }
 
 uint32_t
 unscramble_CCxx(uint32_t creg, uint32_t areg, uint32_t dreg)
 {
-  return ((creg &  CC0_PIN_BITMASK) ?  CC0_BITMASK : 0) |
-         ((creg &  CC1_PIN_BITMASK) ?  CC1_BITMASK : 0) |
-         ((creg &  CC2_PIN_BITMASK) ?  CC2_BITMASK : 0) |
-         ((creg &  CC3_PIN_BITMASK) ?  CC3_BITMASK : 0) |
-         ((creg &  CC4_PIN_BITMASK) ?  CC4_BITMASK : 0) |
-         ((creg &  CC5_PIN_BITMASK) ?  CC5_BITMASK : 0) |
-         // CC6 is in the areg
-         ((areg &  CC6_PIN_BITMASK) ?  CC6_BITMASK : 0) |
-         // CC7-10 are in the dreg
-         ((dreg &  CC7_PIN_BITMASK) ?  CC7_BITMASK : 0) |
-         ((dreg &  CC8_PIN_BITMASK) ?  CC8_BITMASK : 0) |
-         ((dreg &  CC9_PIN_BITMASK) ?  CC9_BITMASK : 0) |
-         ((dreg & CC10_PIN_BITMASK) ? CC10_BITMASK : 0) |
-         // CC11-13 are in the areg
-         ((areg & CC11_PIN_BITMASK) ? CC11_BITMASK : 0) |
-         ((areg & CC12_PIN_BITMASK) ? CC12_BITMASK : 0) |
-         ((areg & CC13_PIN_BITMASK) ? CC13_BITMASK : 0);
+  uint32_t cc = 0;
+#define X(n)  cc |= ((CC_PSR_SELECT(n, creg, areg, dreg) >>                 \
+                      PIN_BIT(CC ## n ## _PIN)) & 1U) << (n);
+  FOREACH_CC(X)
+#undef X
+  return cc;
+}
+
+// The control signals in CDxx_PSR need to be read at the same time as the
+// other control signals, which means we need to read the CDxx_PSR twice
+// and properly mix the bits from the each read into the final result.
+static inline uint32_t
+CDxx_PSR_CC_mask(void)
+{
+  uint32_t mask = 0;
+#define X(n)  if (PIN_IN_PSR(CC ## n ## _PIN, CDxx_PSR)) {                  \
+                mask |= PIN_BITMASK(CC ## n ## _PIN);                     \
+              }
+  FOREACH_CC(X)
+#undef X
+  return mask;
 }
 
+#define CDxx_PSR_CC_MASK  CDxx_PSR_CC_mask()
+#define CDxx_PSR_CD_MASK  (~CDxx_PSR_CC_MASK)
+
 // Rearrange sampled bits of data in buffer back into address, data,
 // and control lines.
 void
 unscramble(void)
 {
+  PERF_BEGIN(perf);
+
   for (int i = 0; i < samples; i++) {
     // Unscramble control signals first; some of them have bits in
     // the data and address line GPIO ports.
@@ -465,6 +470,23 @@ unscramble(void)
     address[i] = unscramble_CAxx(address[i]);
     data[i]    = unscramble_CDxx(data[i]);
    }
+
+  PERF_END(pf_unscramble, perf, samples);
+}
+
+// Accessors for the packed bus cycle type array.
+static inline bus_cycle_t
+bus_cycle(int i)
+{
+  return (bus_cycle_t)((cycles[i >> 1] >> ((i & 1) << 2)) & 0xf);
+}
+
+static inline void
+set_bus_cycle(int i, bus_cycle_t bc)
+{
+  uint8_t shift = (i & 1) << 2;
+
+  cycles[i >> 1] = (cycles[i >> 1] & ~(0xf << shift)) | (bc << shift);
 }
 
 void
@@ -494,6 +516,12 @@ setup(void)
         setBusEnabled(false);
         break;
 
+      case TRIGGER_OUT_PIN:
+        // Trigger out is a push-pull output, for arming an oscilloscope.
+        pinMode(TRIGGER_OUT_PIN, OUTPUT);
+        trigger_out_idle();
+        break;
+
       case BUTTON_PIN:
         // The button goes to ground; we need to figure as an
         // input-pullup.  Interrupt is triggered on the falling
@@ -529,1184 +557,4892 @@ triggerButton(void)
   triggerPressed = true;
 }
 
-const char *
-cpu_name(void)
+// Put the trigger out pin in its inactive state.
+void
+trigger_out_idle(void)
 {
-  switch (cpu) {
-    case cpu_6502:    return "6502";
-    case cpu_65c02:   return "65C02";
-    case cpu_6800:    return "6800";
-    case cpu_6809:    return "6809";
-    case cpu_6809e:   return "6809E";
-    case cpu_z80:     return "Z80";
-    default:          return "not set";
-  }
+  digitalWriteFast(TRIGGER_OUT_PIN, triggerOut == to_low ? HIGH : LOW);
 }
 
-void
-show_cpu(void)
+//
+// CPU DESCRIPTORS
+//
+// Everything that differs between the supported CPUs -- how to clock
+// the bus, how to classify bus cycles, what the control signals are
+// called, what's in the vector table, which decoder to use, and how to
+// encode triggers -- is described by a cpu_descriptor.  Adding a new CPU
+// should just be a matter of adding a new descriptor (and, if needed, a
+// new capture wrapper, classifier, and decoder).
+//
+
+// A probed control signal.  The signal tables are in CSV export order.
+struct cpu_signal {
+  const char  *name;          // e.g. "/RESET"
+  uint32_t    mask;           // logical CC_xxx_yyy bitmask
+  bool        active_low;
+  bool        csv;            // included in CSV export
+  const char  *comment;       // list() comment when asserted, or NULL
+};
+
+// An address range that gets annotated in the listing (vectors, stack).
+struct cpu_region {
+  uint16_t    first;
+  uint16_t    last;
+  const char  *name;
+};
+
+struct cpu_descriptor {
+  const char                *name;
+  cpu_t                     type;
+  bool                      has_iospace;
+
+  void                      (*capture)(void);
+  void                      (*count)(void);
+  void                      (*histogram)(void);
+  void                      (*trace)(void);
+  void                      (*writes)(void);
+  void                      (*watch)(void);
+  void                      (*compress)(void);
+  bus_cycle_t               (*classify)(int, uint32_t *);
+  void                      (*decode)(struct insn_decode *);
+  void                      (*illegal)(uint8_t *);  // NULL if none
+
+  const struct cpu_signal   *signals;
+  const struct cpu_region   *regions;
+
+  // Trigger encodings, as logical CC_xxx_yyy bitmasks.  A zero signal
+  // mask means that the CPU does not have that signal.
+  uint32_t                  tr_reset;
+  uint32_t                  tr_irq;
+  uint32_t                  tr_firq;
+  uint32_t                  tr_nmi;
+  uint32_t                  space_mask;   // memory vs. I/O cycle qualifier
+  uint32_t                  mem_bits;
+  uint32_t                  io_bits;
+  uint32_t                  rw_mask;      // read vs. write cycle qualifier
+  uint32_t                  read_bits;
+  uint32_t                  write_bits;
+
+  // Interrupt acknowledge: a control signal pattern if ack_mask is
+  // non-zero, otherwise any read from the vector table (vec_first
+  // through vec_last).
+  uint32_t                  ack_mask;
+  uint32_t                  ack_bits;
+  uint16_t                  vec_first;
+  uint16_t                  vec_last;
+
+  // Opcode fetch, as a control signal pattern that the counter kernels
+  // can check on the raw port values.  If fetch_follows is set, the
+  // fetch is the cycle after the pattern goes away (6809E LIC).  A zero
+  // fetch_mask means the CPU doesn't tell us, and every cycle is
+  // treated as a fetch.
+  uint32_t                  fetch_mask;
+  uint32_t                  fetch_bits;
+  bool                      fetch_follows;
+
+  // Halted or waiting, as a control signal pattern: the CPU isn't using
+  // the bus, or (Z80 HALT) is only running NOPs and refreshing.  While
+  // it matches, a compressed capture folds every bus cycle into one
+  // record.  A zero halt_mask means there's no such signal.
+  uint32_t                  halt_mask;
+  uint32_t                  halt_bits;
+};
+
+const struct cpu_descriptor *cpu_desc;  // Descriptor for current CPU type
+uint8_t illegalMap[INSN_ILLEGAL_MAP_SIZE];  // Current CPU's undefined opcodes
+
+// CSV export column selection.  An empty selection means the CPU's
+// default column set (the signals marked "csv" in its signal table).
+struct export_column {
+  export_col_t              type;
+  const struct cpu_signal   *sig;     // for ec_signal
+};
+#define MAX_EXPORT_COLUMNS  24
+// The widest column is a quoted instruction and the comma before it.
+#define EXPORT_COLUMN_WIDTH (INSN_DECODE_MAXSTRING + 2)
+struct export_column exportColumns[MAX_EXPORT_COLUMNS];
+int exportColumnCount = 0;
+
+// A bus match condition, as entered by the user.  The trigger is one
+// of these, and so is each event counter term.
+struct match_spec {
+  trigger_t   mode;
+  cycle_t     cycle;
+  space_t     space;
+  bool        level;
+  uint32_t    address;
+  uint32_t    address_mask;           // bits of address that must match
+  uint32_t    data;
+  uint32_t    data_mask;              // bits of data that must match
+};
+
+// A match_spec encoded as the GPIO port bit patterns that the capture
+// loops compare against.
+struct bus_match {
+  uint32_t    a_mask;
+  uint32_t    a_bits;
+  uint32_t    c_mask;
+  uint32_t    c_bits;
+  uint32_t    d_mask;
+  uint32_t    d_bits;
+};
+
+static inline bool
+bus_match_p(const struct bus_match *bm, uint32_t a, uint32_t c, uint32_t d)
 {
-  tla_printf("CPU: %s\n", cpu_name());
+  return (a & bm->a_mask) == bm->a_bits &&
+         (d & bm->d_mask) == bm->d_bits &&
+         (c & bm->c_mask) == bm->c_bits;
 }
 
+// Trigger stages after the first ("trigger then ...").  The first stage
+// is triggerMode and friends.  Each stage must match count bus cycles
+// before the next one is looked for, and the last one triggers.
+#define TRIG_STAGES       4
+struct trig_stage {
+  struct match_spec spec;
+  uint32_t          count;
+};
+struct trig_stage triggerThen[TRIG_STAGES - 1];
+int triggerThenCount = 0;
+uint32_t triggerCount = 1;            // Times the first stage must match
+
+// Trigger program.  setup_triggers() compiles the trigger stages into a
+// program for a small virtual machine, which the capture kernels run on
+// every bus cycle until it fires.  Each bus cycle runs instructions from
+// the current state's entry point until one of them ends the cycle
+// (tp_end, tp_goto or tp_fire).  Branches only go forward, so
+// trig_check() can work out the most instructions any bus cycle can
+// run, and a program that could run more than TRIG_MAX_STEPS is never
+// armed.
+#define TRIG_MAX_INSNS    32
+#define TRIG_MAX_STEPS    8
+#define TRIG_REGS         TRIG_STAGES
+struct trig_insn {
+  uint8_t           op;               // trig_op_t
+  uint8_t           arg;              // match, register, skip or state
+  uint32_t          imm;
+};
+struct trig_insn trigProgram[TRIG_MAX_INSNS];
+int trigLength;
+struct bus_match trigMatches[TRIG_STAGES];
+int trigMatchCount;
+uint32_t trigRegs[TRIG_REGS];
+int trigState;                        // Entry point for the next bus cycle
+
+// Most triggers are a single stage that fires on its first match.  For
+// those trig_compile() sets trigFast, and the kernels compare the bus
+// cycle with trigFastMatch directly instead of running the program.
+bool trigFast;
+struct bus_match trigFastMatch;
+
+// Value-change trigger shadow: the last value written to each address
+// during this capture, and which addresses have been written.  It's in
+// RAM2 (DMAMEM), since RAM1 is taken up by the sample buffer and the
+// memory image.
+DMAMEM uint8_t changeShadow[65536];
+DMAMEM uint8_t changeSeen[65536 / 8];
+
+// Opcode fetch detection for tp_illegal (see cpu_descriptor).  If the
+// program has a tp_illegal, trigTrackFetch is set and every bus cycle
+// updates trigFetchPrev, whichever stage is current, so a later stage
+// starts off knowing whether the previous cycle was a fetch.
+struct bus_match trigFetch;
+bool trigFetchFollows;
+bool trigFetchPrev;
+bool trigTrackFetch;
+
 void
-set_cpu(cpu_t ncpu)
+trig_reset(void)
 {
-  if (triggerSpace == tr_io && !cpu_has_iospace(ncpu)) {
-    triggerSpace = tr_mem;
-    triggerMode = tr_none;
-  }
-  cpu = ncpu;
+  trigState = 0;
+  memset(trigRegs, 0, sizeof(trigRegs));
+  memset(changeSeen, 0, sizeof(changeSeen));
+  trigFetchPrev = false;
 }
 
-const char *
-trigger_signal_name(trigger_t t)
+// Returns true if this bus cycle is an opcode fetch.  Called once per
+// bus cycle when trigTrackFetch is set.
+__attribute__((__always_inline__))
+static inline bool
+trig_fetch(uint32_t a, uint32_t c, uint32_t d)
 {
-  switch (t) {
-    case tr_reset:    return "/RESET";
-    case tr_irq:      return cpu == cpu_z80 ? "/INT" : "/IRQ";
-    case tr_firq:     return "/FIRQ";
-    case tr_nmi:      return "/NMI";
-    default:          return "<unknown>";
+  bool m = bus_match_p(&trigFetch, a, c, d);
+  bool fetch = trigFetchFollows ? (trigFetchPrev && !m) : m;
+
+  trigFetchPrev = m;
+  return fetch;
+}
+
+// Returns true if this bus cycle fetches an opcode in illegalMap.
+__attribute__((__always_inline__))
+static inline bool
+trig_illegal(bool fetch, uint32_t d)
+{
+  uint32_t op;
+
+  if (!fetch) {
+    return false;
   }
+  op = unscramble_CDxx(d) & 0xff;
+  return (illegalMap[op >> 3] & (1U << (op & 7))) != 0;
 }
 
-const char *
-trigger_cycle_name(cycle_t c)
+// A tp_change instruction's write matched.  If expect is 0, it's a
+// change if the value differs from the last one written to the same
+// address, and the shadow is updated; the first write to an address
+// is never a change.  Otherwise the low byte of expect is the expected
+// value and the next byte is the data mask.
+__attribute__((__always_inline__))
+static inline bool
+trig_changed(uint32_t a, uint32_t d, uint32_t expect)
 {
-  switch (c) {
-    case tr_read:       return "read";
-    case tr_write:      return "write";
-    case tr_either:     return "read or write";
-    default:            return "<unknown>";
+  uint32_t addr = unscramble_CAxx(a) & 0xffff;
+  uint32_t value = unscramble_CDxx(d) & 0xff;
+  uint8_t *seen = &changeSeen[addr >> 3];
+  uint8_t bit = 1U << (addr & 7);
+  bool changed;
+
+  if (expect != 0) {
+    return (value & (expect >> 8)) != (expect & 0xff);
   }
+  changed = (*seen & bit) != 0 && changeShadow[addr] != value;
+  changeShadow[addr] = value;
+  *seen |= bit;
+  return changed;
 }
 
-void
-show_trigger(void)
+// Run the trigger program for one bus cycle (raw port values).  Returns
+// true if the trigger fires.
+__attribute__((__always_inline__))
+static inline bool
+trig_step(uint32_t a, uint32_t c, uint32_t d)
 {
-  char msg[80], *cp = msg;
+  const struct trig_insn *ti;
+  bool flag = false, fetch = false;
 
-  cp += sprintf(cp, "Trigger: ");
-  switch (triggerMode) {
-    case tr_address:
-    case tr_data:
-    case tr_addr_data:
-      cp = msg;
-      cp += sprintf(cp, "on%s %s ",
-          triggerSpace == tr_io ? " io" : "",
-          triggerMode == tr_data ? "data" : "address");
-      if (triggerMode != tr_data) {
-        if (triggerSpace == tr_io) {
-          cp += sprintf(cp, "%02lX ", triggerAddress);
-        } else {
-          cp += sprintf(cp, "%04lX ", triggerAddress);
+  if (trigTrackFetch) {
+    fetch = trig_fetch(a, c, d);
+  }
+  for (ti = &trigProgram[trigState]; ; ti++) {
+    switch (ti->op) {
+      case tp_match:
+        flag = bus_match_p(&trigMatches[ti->arg], a, c, d);
+        break;
+
+      case tp_change:
+        flag = bus_match_p(&trigMatches[ti->arg], a, c, d) &&
+            trig_changed(a, d, ti->imm);
+        break;
+
+      case tp_illegal:
+        flag = trig_illegal(fetch, d);
+        break;
+
+      case tp_skip_unless:
+        if (!flag) {
+          ti += ti->arg;
         }
-      } else {
-        cp += sprintf(cp, "%02lX ", triggerData);
-      }
-      if (triggerMode == tr_addr_data) {
-        cp += sprintf(cp, "and data %02lX ", triggerData);
-      }
-      cp += sprintf(cp, "%s", trigger_cycle_name(triggerCycle));
-      break;
+        break;
 
-    case tr_reset:
-    case tr_irq:
-    case tr_firq:
-    case tr_nmi:
-      cp += sprintf(cp, "on %s %s", trigger_signal_name(triggerMode),
-          triggerLevel ? "high" : "low");
-      break;
+      case tp_inc:
+        trigRegs[ti->arg]++;
+        break;
 
-    case tr_manual:
-      cp += sprintf(cp, "manual (button)");
-      break;
+      case tp_ge:
+        flag = trigRegs[ti->arg] >= ti->imm;
+        break;
 
-    case tr_none:
-      cp += sprintf(cp, "none (immediate)");
-      break;
+      case tp_goto:
+        trigState = ti->arg;
+        return false;
+
+      case tp_fire:
+        return true;
+
+      default:
+        return false;
+    }
   }
-  tla_printf("%s\n", msg);
 }
 
-void
-show_samples(void)
+// Returns true if the trigger fires on this bus cycle.  The kernels
+// copy trigFast and trigFastMatch into fast and fm before their loop.
+__attribute__((__always_inline__))
+static inline bool
+trig_hit(bool fast, const struct bus_match *fm, uint32_t a, uint32_t c, uint32_t d)
 {
-  tla_printf("Sample buffer size: %d\n", samples);
+  return fast ? bus_match_p(fm, a, c, d) : trig_step(a, c, d);
 }
 
-void
-show_pretrigger(void)
+// Event counter terms.  Each term counts the bus cycles that match it
+// (or, for signal terms, the times the signal goes to the given level)
+// and keeps statistics on the number of bus cycles between events.
+#define COUNT_TERMS   4
+struct count_term {
+  struct match_spec spec;
+  struct bus_match  match;            // encoded when the counter starts
+  bool              edge;             // count transitions into the match
+  bool              matched;          // matched on the previous cycle
+  uint64_t          count;
+  uint64_t          last;             // bus cycle of the previous event
+  uint64_t          interval_min;
+  uint64_t          interval_max;
+  uint64_t          interval_total;
+};
+struct count_term countTerms[COUNT_TERMS];
+int countTermCount = 0;
+uint64_t countCycles;                 // Bus cycles counted
+uint32_t countMillis;                 // Time spent counting
+uint32_t countDuration;               // Milliseconds to count for (0 = until Ctrl-C)
+uint32_t countReportInterval = 1000;  // Milliseconds between reports (0 = none)
+
+// Address-range time histogram.  Every bus cycle is charged to the
+// range holding the most recently fetched opcode.  histRangeMap gives
+// the range of each address (0 for none), so attributing a fetch costs
+// a single table lookup.
+#define HIST_RANGES   32
+#define HIST_NAMELEN  12
+struct hist_range {
+  uint16_t    first;
+  uint16_t    last;
+  char        name[HIST_NAMELEN];
+};
+struct hist_range histRanges[HIST_RANGES];
+int histRangeCount = 0;
+uint8_t histRangeMap[65536];
+uint64_t histCycles[HIST_RANGES + 1]; // Indexed by range + 1; [0] is "other"
+uint32_t histMillis;                  // Time spent in the histogram kernel
+uint32_t histDuration;                // Milliseconds to run for (0 = until Ctrl-C)
+uint32_t histReportInterval = 5000;   // Milliseconds between reports (0 = none)
+
+// Branch trace.  A trace capture only stores opcode fetches that don't
+// follow on from the previous instruction (branches, calls, returns,
+// interrupts), and writes.  For each record, recordInfo holds the number
+// of sequential fetches that were skipped before it and the address of
+// the last fetch before it; the skipped instructions are reconstructed
+// afterwards from a memory image.  traceLength gives the length of each
+// opcode, or 0 if the length depends on more than the opcode; a fetch
+// that follows one of those is always recorded.
+#define TRACE_FETCH       0x80000000U   // record is an opcode fetch
+#define TRACE_SKIP_SHIFT  16
+#define TRACE_SKIP_MAX    0x7fffU
+#define TRACE_FROM_MASK   0xffffU
+uint8_t traceLength[256];
+cpu_t traceLengthCpu = cpu_none;      // CPU traceLength was computed for
+uint32_t traceCycles;                 // Bus cycles covered by the trace
+
+// Memory watch.  watchMap has a bit set for each watched address, so
+// the watch kernel can tell with one lookup whether a bus cycle needs a
+// closer look; only then does it search watchSlots.
+#define WATCH_SLOTS     16
+#define WATCH_INTERVAL  250           // milliseconds between updates
+struct watch_slot {
+  uint16_t    addr;
+  uint8_t     value;                  // last value read or written
+  uint8_t     shown;                  // value at the last update
+  bool        valid;                  // value has been seen
+  bool        written;                // the last access was a write
+  uint32_t    reads;
+  uint32_t    writes;
+  uint32_t    shown_accesses;         // reads + writes at the last update
+};
+struct watch_slot watchSlots[WATCH_SLOTS];
+int watchSlotCount = 0;
+space_t watchSpace = tr_mem;
+uint8_t watchMap[65536 / 8];
+uint32_t watchMillis;                 // Time spent watching
+
+// Write log.  A write log capture only stores write cycles (and the
+// trigger cycle); recordInfo holds the number of bus cycles since the
+// previous record, so the listing can show when each write happened.
+
+// Compressed capture.  Repeated bus cycles are stored once, and
+// recordInfo holds the number of times each record repeated.
+
+// Instruction mix.  Instructions are counted by their decoded text with
+// the operand values taken out ("LDA $nnnn"), so the counts are per
+// mnemonic and addressing mode whichever CPU is selected.
+#define MIX_ENTRIES 256
+struct mix_entry {
+  char                      insn[INSN_DECODE_MAXSTRING];
+  uint32_t                  count;
+};
+struct mix_entry mixTable[MIX_ENTRIES];
+int mixEntries;
+
+// Static listing.  "static add" folds the instructions executed in a
+// capture into codeTable, one entry per address and instruction bytes,
+// so that code that ran many times is listed (and formatted) once, with
+// an execution count.  codeTargets marks the addresses that execution
+// was seen to jump to.
+#define CODE_ENTRIES 2048             // must be a power of 2
+struct code_entry {
+  uint16_t                  addr;
+  uint8_t                   len;      // 0 if the entry is free
+  uint8_t                   bytes[INSN_DECODE_MAXBYTES];
+  uint32_t                  count;
+};
+struct code_entry codeTable[CODE_ENTRIES];
+uint16_t codeOrder[CODE_ENTRIES];     // codeTable sorted by address
+int codeEntries;
+uint32_t codeCaptures;
+uint8_t codeTargets[65536 / 8];
+
+// Memory image: what is known of the target's memory (e.g. its ROM),
+// used to fill in bytes that weren't captured.
+uint8_t memImage[65536];
+uint8_t memImageValid[65536 / 8];
+
+// Await a clock edge: (level == HIGH) is the rising edge, (level == LOW)
+// the falling edge.
+#define WAIT_EDGE(pin, level)                                   \
+  do {                                                          \
+    while (digitalReadFast(pin) == (level)) ;                   \
+    while (digitalReadFast(pin) != (level)) ;                   \
+  } while (0)
+
+// Called by the capture kernels when the trigger condition matches:
+// asserts trigger out, notes the time and turns off the LED.  The
+// cycle counter is only read here, not on every sample, so
+// triggerOutLatency runs from the trigger being detected to the pin
+// write; the time to see the bus edge, read the data lines and match
+// the trigger isn't in it, and it is a lower bound on the pin's true
+// latency.
+__attribute__((__always_inline__))
+static inline void
+trigger_seen(void)
 {
-  tla_printf("Pretrigger samples: %d\n", pretrigger);
+  uint32_t detected = ARM_DWT_CYCCNT;
+
+  if (triggerOut != to_off) {
+    digitalWriteFast(TRIGGER_OUT_PIN, triggerOut == to_high ? HIGH : LOW);
+  }
+  triggerCyccnt = ARM_DWT_CYCCNT;
+  triggerOutLatency = triggerCyccnt - detected;
+  digitalWriteFast(CORE_LED0_PIN, LOW); // Indicates received trigger
 }
 
-void
-disassemble_one(uint32_t where)
+// Capture kernel.  This is always inlined into the per-CPU capture
+// wrappers below so that the clock pins and edges are compile-time
+// constants; there is no per-sample branching on the CPU type.
+__attribute__((__always_inline__))
+static inline void
+capture_samples(int aclk, int aedge, int dclk, int dedge)
 {
-  struct insn_decode id;
-  insn_decode_init(&id);
+  int i = 0; // Index into data buffers
+  bool triggered = false; // Set when triggered
+  uint32_t cd_psr_cc_bits;
+  const bool fast = trigFast;
+  const struct bus_match fm = trigFastMatch;
 
-  int first = (triggerPoint - pretrigger + samples) % samples;
-  int last = (triggerPoint - pretrigger + samples - 1) % samples;
-  int i;
+  while (true) {
+    WAIT_EDGE(aclk, aedge);
 
-  // First, search through the sample data looking for the address.
-  for (i = first; i != last; i = (i + 1) % samples) {
-    if (address[i] == where) {
-      break;
-    }
-  }
-  if (address[i] != where) {
-    tla_printf("Address not found in sample data.\n");
-    return;
-  }
+    // Read address and control lines.  Note that some of the control
+    // lines are in the CDxx_PSR, and we need to extract those as well.
+    control[i] = CCxx_PSR;
+    address[i] = CAxx_PSR;
+    cd_psr_cc_bits = CDxx_PSR & CDxx_PSR_CC_MASK;
 
-  for (;; i = (i + 1) % samples) {
-    switch (id.state) {
-      case ds_idle:
-        insn_decode_begin(&id, address[i], data[i]);
-        goto printit;
+    WAIT_EDGE(dclk, dedge);
 
-      case ds_fetching:
-        if (address[i] != where + id.bytes_fetched) {
-          tla_printf("!!!! Non-contiguous instruction fetch?\n");
-        }
-        // FALLTHROUGH
+    // Read data lines.  Mask out the control bits on this
+    // read and mix in the control bits read above.
+    data[i] = (CDxx_PSR & CDxx_PSR_CD_MASK) | cd_psr_cc_bits;
 
-      default:
-        insn_decode_continue(&id, data[i]);
-      printit:
-        tla_printf("%04lX  %02lX  %s\n",
-            address[i], data[i], insn_decode_complete(&id));
-        break;
+    // Set triggered flag if trigger button pressed or trigger seen
+    // If triggered, increment buffer index
+    if (!triggered) {
+      if (triggerPressed || trig_hit(fast, &fm, address[i], control[i], data[i])) {
+        triggered = true;
+        triggerPoint = i;
+        trigger_seen();
+      }
     }
-    if (id.state == ds_complete || i == last) {
-      return;
+
+    // Count number of samples taken after trigger
+    if (triggered) {
+      samplesTaken++;
     }
-  }
-}
 
-// List recorded data from start to end.
-void
-list(Stream &stream, int start, int end, int validSamples)
-{
-  char output[80];
-  char comment[30], *cp;
+    // Exit when buffer is full of samples
+    if (samplesTaken >= (samples - pretrigger)) {
+      break;
+    }
 
-  if (cpu == cpu_none || validSamples == 0) {
-    return;
+    i = (i + 1) % samples; // Increment index, wrapping around at end for circular buffer
   }
+}
 
-  int first = (triggerPoint - pretrigger + samples) % samples;
-  int last = (triggerPoint - pretrigger + samples - 1) % samples;
-
-  bool have_lic, seen_lic = false;
-
-  const char *cycle, *trig;
-  const char *comma;
+// Write log kernel.  The same as the capture kernel, except that only
+// write cycles and the trigger cycle are stored.  qual is any extra
+// control signal that must be asserted for a write to be valid (6800
+// VMA).  If edge_only is set, a write spans several samples (Z80 T
+// states), and is only stored the first time it is seen.
+__attribute__((__always_inline__))
+static inline void
+capture_writes(int aclk, int aedge, int dclk, int dedge, uint32_t qual, bool edge_only)
+{
+  struct bus_match write;
+  uint32_t a, c, d, cd_psr_cc_bits, delta = 0;
+  bool triggered = false, trig, m, prev = false;
+  int i = 0;
+  const bool fast = trigFast;
+  const struct bus_match fm = trigFastMatch;
 
-  struct insn_decode id;
-  insn_decode_init(&id);
+  encode_signals(cpu_desc->rw_mask | qual, cpu_desc->write_bits | qual, &write);
 
-  // Display data
-  int i = first;
-  int j = 0;
   while (true) {
-    cycle = "";
-    trig = "";
-    comma = "";
-    comment[0] = '\0';
-    cp = comment;
+    WAIT_EDGE(aclk, aedge);
 
-    if ((j >= start) && (j <= end)) {
+    c = CCxx_PSR;
+    a = CAxx_PSR;
+    cd_psr_cc_bits = CDxx_PSR & CDxx_PSR_CC_MASK;
 
-      // 6502 SYNC high indicates opcode/instruction fetch, otherwise
-      // show as read or write.
-      if ((cpu == cpu_65c02) || (cpu == cpu_6502)) {
-        if (control[i] & CC_6502_SYNC) {
-          insn_decode_begin(&id, address[i], data[i]);
-          cycle = "F";
-        } else if (control[i] & CC_6502_RW) {
-          cycle = insn_decode_continue(&id, data[i]) ? "*" : "R";
-        } else {
-          cycle = "W";
-        }
-      }
+    WAIT_EDGE(dclk, dedge);
 
-      if (cpu == cpu_6809 || cpu == cpu_6809e) {
-        // Get the current status of LIC.  Note that LIC will also
-        // be high while the processor is in SYNC state or while
-        // stacking registers during an interrupt.
-        have_lic = (cpu == cpu_6809e && (control[i] & CC_6809E_LIC));
-
-        // 6809 doens't have a VMA signal like the 6800, but the
-        // data sheet describes how to detect a so-called "dummy
-        // cycle" (which is also calls "/VMA").
-        if (address[i] == 0xffff &&
-            (control[i] & (CC_6809_RW | CC_6809_BS)) == CC_6809_RW) {
-          cycle = "-";
-        } else if (control[i] & CC_6809_RW) {
-          // On 6809E, if we saw LIC on the previous cycle, then
-          // this is an insn fetch.  Don't try to decode an instruction
-          // if it looks like we're doing a vector fetch, though.
-          cycle = "R";
-          if (cpu == cpu_6809e && address[i] < 0xfff0) {
-            // Even if we have seen LIC go by, it's not an
-            // instruction fetch until LIC goes low.
-            if (seen_lic && !have_lic) {
-              cycle = "F";
-              insn_decode_begin(&id, address[i], data[i]);
-              seen_lic = false;
-            } else {
-              if (insn_decode_continue(&id, data[i])) {
-                cycle = "*";
-              }
-            }
-          }
-        } else {
-          cycle = "W";
-        }
-        if (have_lic) {
-          seen_lic = true;
-        }
-      }
+    d = (CDxx_PSR & CDxx_PSR_CD_MASK) | cd_psr_cc_bits;
 
-      if (cpu == cpu_z80) {
-        // /M1 /MREQ  /IORQ /RD /WR
-        //  1    0      1    0   1   Memory read
-        //  1    0      1    1   0   Memory write
-        //  0    0      1    0   1   Instruction fetch
-        //  1    1      0    0   1   I/O read
-        //  1    1      0    1   0   I/O write
-
-        if (!(control[i] & CC_Z80_M1)) {
-          cycle = "F";
-          insn_decode_begin(&id, address[i], data[i]);
-        } else if (!(control[i] & CC_Z80_MREQ) && !(control[i] & CC_Z80_RD)) {
-          cycle = insn_decode_continue(&id, data[i]) ? "*" : "R";
-        } else if (!(control[i] & CC_Z80_MREQ) && !(control[i] & CC_Z80_WR)) {
-          cycle = "W";
-        } else if (!(control[i] & CC_Z80_IORQ) && !(control[i] & CC_Z80_RD)) {
-          cycle = "IR";
-        } else if (!(control[i] & CC_Z80_IORQ) && !(control[i] & CC_Z80_WR)) {
-          cycle = "IW";
-        }
-      }
+    if (delta != ~0U) {
+      delta++;
+    }
+    m = bus_match_p(&write, a, c, d);
 
-      if (cpu == cpu_6800) {
-        // VMA R/W
-        //  0   X  Internal cycle
-        //  1   0  Memory read
-        //  1   1  Memory write
-        if (!(control[i] & CC_6800_VMA)) {
-          cycle = "-";
-        } else {
-          if (control[i] & CC_6800_RW) {
-            cycle = "R";
-          } else {
-            cycle = "W";
-          }
-        }
+    trig = false;
+    if (!triggered) {
+      if (triggerPressed || trig_hit(fast, &fm, a, c, d)) {
+        triggered = trig = true;
+        trigger_seen();
       }
+    }
 
-#define COMMENT(str) do { cp += sprintf(cp, "%s%s", comma, str); comma = ","; } while (0)
-
-      // Check for 6502 /RESET, /IRQ, or /NMI active, vector address, or
-      // stack access
-      if ((cpu == cpu_65c02) || (cpu == cpu_6502)) {
-        if (!(control[i] & CC_6502_RESET)) {
-          COMMENT("RESET");
-        }
-        if (!(control[i] & CC_6502_IRQ)) {
-          COMMENT("IRQ");
-        }
-        if (!(control[i] & CC_6502_NMI)) {
-          COMMENT("NMI");
-        }
-        if ((address[i] == 0xfffa) || (address[i] == 0xfffb)) {
-          COMMENT("NMI VECTOR");
-        } else if ((address[i] == 0xfffc) || (address[i] == 0xfffd)) {
-          COMMENT("RESET VECTOR");
-        } else if ((address[i] == 0xfffe) || (address[i] == 0xffff)) {
-          COMMENT("IRQ/BRK VECTOR");
-        } else if ((address[i] >= 0x0100) && (address[i] <= 0x01ff)) {
-          COMMENT("STACK ACCESS");
-        }
+    if (!trig && (!m || (edge_only && prev))) {
+      prev = m;
+      continue;
+    }
+    prev = m;
+
+    control[i] = c;
+    address[i] = a;
+    data[i] = d;
+    recordInfo[i] = delta;
+    delta = 0;
+    if (trig) {
+      triggerPoint = i;
+    }
+
+    if (triggered) {
+      samplesTaken++;
+    }
+    if (samplesTaken >= (samples - pretrigger)) {
+      break;
+    }
+
+    i = (i + 1) % samples;
+  }
+}
+
+// Compressed capture kernel.  The same as the capture kernel, except
+// that a bus cycle that repeats the one before it isn't stored, and
+// nor is anything while the CPU stays halted (halt_mask); recordInfo
+// counts the bus cycles folded into each record.  Wait states, and
+// WAI, SYNC, CWAI and HALT loops, take one record however long they
+// last.
+__attribute__((__always_inline__))
+static inline void
+capture_compressed(int aclk, int aedge, int dclk, int dedge)
+{
+  struct bus_match halt;
+  const bool has_halt = cpu_desc->halt_mask != 0;
+  uint32_t a, c, d, cd_psr_cc_bits;
+  bool triggered = false, trig, halted, was_halted = false;
+  int i = 0, prev = -1;
+  const bool fast = trigFast;
+  const struct bus_match fm = trigFastMatch;
+
+  encode_signals(cpu_desc->halt_mask, cpu_desc->halt_bits, &halt);
+
+  while (true) {
+    WAIT_EDGE(aclk, aedge);
+
+    c = CCxx_PSR;
+    a = CAxx_PSR;
+    cd_psr_cc_bits = CDxx_PSR & CDxx_PSR_CC_MASK;
+
+    WAIT_EDGE(dclk, dedge);
+
+    d = (CDxx_PSR & CDxx_PSR_CD_MASK) | cd_psr_cc_bits;
+
+    trig = false;
+    if (!triggered) {
+      if (triggerPressed || trig_hit(fast, &fm, a, c, d)) {
+        triggered = trig = true;
+        trigger_seen();
       }
+    }
 
-      // Check for 6800 /RESET, /IRQ, or /NMI active, vector address.
-      if (cpu == cpu_6800) {
-        if (!(control[i] & CC_6800_RESET)) {
-          COMMENT("RESET");
-        }
-        if (!(control[i] & CC_6800_IRQ)) {
-          COMMENT("IRQ");
-        }
-        if (!(control[i] & CC_6800_NMI)) {
-          COMMENT("NMI");
-        }
-        if ((address[i] == 0xfff8) || (address[i] == 0xfff8)) {
-          COMMENT("IRQ VECTOR");
-        } else if ((address[i] == 0xfffa) || (address[i] == 0xfffb)) {
-          COMMENT("SWI VECTOR");
-        } else if ((address[i] == 0xfffc) || (address[i] == 0xfffd)) {
-          COMMENT("NMI VECTOR");
-        } else if (address[i] == 0xfffe) { // Not 0xffff since it commonly occurs when bus is tri-state
-          COMMENT("RESET VECTOR");
-        }
+    halted = has_halt && bus_match_p(&halt, a, c, d);
+    if (!trig && prev >= 0 &&
+        (halted ? was_halted :
+         (a == address[prev] && c == control[prev] && d == data[prev]))) {
+      if (recordInfo[prev] != ~0U) {
+        recordInfo[prev]++;
       }
+      continue;
+    }
+    was_halted = halted;
+
+    control[i] = c;
+    address[i] = a;
+    data[i] = d;
+    recordInfo[i] = 0;
+    prev = i;
+    if (recordsStored < samples) {
+      recordsStored++;
+    }
+    if (trig) {
+      triggerPoint = i;
+    }
 
-      // Check for 6809 /RESET, /IRQ, or /NMI active, vector address.
-      if (cpu == cpu_6809 || cpu == cpu_6809e) {
-        if (!(control[i] & CC_6809_RESET)) {
-          COMMENT("RESET");
-        }
-        if (!(control[i] & CC_6809_IRQ)) {
-          COMMENT("IRQ");
-        }
-        if (!(control[i] & CC_6809_FIRQ)) {
-          COMMENT("FIRQ");
-        }
-        if (!(control[i] & CC_6809_NMI)) {
-          COMMENT("NMI");
-        }
-        if ((address[i] == 0xfff2) || (address[i] == 0xfff3)) {
-          COMMENT("SWI3 VECTOR");
-        } else if ((address[i] == 0xfff4) || (address[i] == 0xfff5)) {
-          COMMENT("SWI2 VECTOR");
-        } else if ((address[i] == 0xfff6) || (address[i] == 0xfff7)) {
-          COMMENT("FIRQ VECTOR");
-        } else if ((address[i] == 0xfff8) || (address[i] == 0xfff9)) {
-          COMMENT("IRQ VECTOR");
-        } else if ((address[i] == 0xfffa) || (address[i] == 0xfffb)) {
-          COMMENT("SWI VECTOR");
-        } else if ((address[i] == 0xfffc) || (address[i] == 0xfffd)) {
-          COMMENT("NMI VECTOR");
-        } else if (address[i] == 0xfffe) { // Not 0xffff since it commonly occurs when bus is tri-state
-          COMMENT("RESET VECTOR");
+    if (triggered) {
+      samplesTaken++;
+    }
+    if (samplesTaken >= (samples - pretrigger)) {
+      break;
+    }
+
+    i = (i + 1) % samples;
+  }
+}
+
+// Housekeeping for the counter kernels, which call this every 4096 bus
+// cycles.  Adds the time since the last report to *elapsedp and calls
+// report() every interval milliseconds.  Returns true when the run is
+// over: duration milliseconds have passed or the user typed Ctrl-C.
+bool
+counter_poll(uint32_t start, uint32_t duration, uint32_t *reportedp,
+    uint32_t interval, uint32_t *elapsedp, void (*report)(void))
+{
+  uint32_t now = millis();
+  bool done = (duration != 0 && now - start >= duration) || userInterrupt();
+
+  if (done || (interval != 0 && now - *reportedp >= interval)) {
+    *elapsedp += now - *reportedp;
+    *reportedp = now;
+    if (!done) {
+      (*report)();
+    }
+  }
+  return done;
+}
+
+// Counter kernel.  Like the capture kernel, but nothing is stored:
+// each bus cycle is compared against the counter terms in place, using
+// the raw port values.  Every 4096 cycles it stops to check the clock
+// and the console, so it can run for as long as is needed.
+__attribute__((__always_inline__))
+static inline void
+count_events(int aclk, int aedge, int dclk, int dedge)
+{
+  struct count_term *ct, * const end = &countTerms[countTermCount];
+  uint32_t a, c, d, cd_psr_cc_bits;
+  uint32_t start = millis(), reported = start;
+  uint64_t t;
+  bool m;
+
+  while (true) {
+    WAIT_EDGE(aclk, aedge);
+
+    c = CCxx_PSR;
+    a = CAxx_PSR;
+    cd_psr_cc_bits = CDxx_PSR & CDxx_PSR_CC_MASK;
+
+    WAIT_EDGE(dclk, dedge);
+
+    d = (CDxx_PSR & CDxx_PSR_CD_MASK) | cd_psr_cc_bits;
+    countCycles++;
+
+    for (ct = countTerms; ct < end; ct++) {
+      m = bus_match_p(&ct->match, a, c, d);
+      if (m && !(ct->edge && ct->matched)) {
+        if (ct->count++ != 0) {
+          t = countCycles - ct->last;
+          if (ct->count == 2 || t < ct->interval_min) {
+            ct->interval_min = t;
+          }
+          if (t > ct->interval_max) {
+            ct->interval_max = t;
+          }
+          ct->interval_total += t;
         }
+        ct->last = countCycles;
       }
+      ct->matched = m;
+    }
+
+    if ((countCycles & 4095) == 0 &&
+        counter_poll(start, countDuration, &reported, countReportInterval,
+            &countMillis, count_report)) {
+      break;
+    }
+  }
+}
+
+// Histogram kernel.  Attributes every bus cycle to the address range
+// of the last opcode fetch.
+__attribute__((__always_inline__))
+static inline void
+histogram_events(int aclk, int aedge, int dclk, int dedge)
+{
+  struct bus_match fetch;
+  const bool follows = cpu_desc->fetch_follows;
+  uint32_t a, c, d, cd_psr_cc_bits;
+  uint32_t start = millis(), reported = start;
+  uint64_t *counter = &histCycles[0];
+  uint32_t n = 0;
+  bool m, prev = false;
+
+  encode_signals(cpu_desc->fetch_mask, cpu_desc->fetch_bits, &fetch);
+
+  while (true) {
+    WAIT_EDGE(aclk, aedge);
+
+    c = CCxx_PSR;
+    a = CAxx_PSR;
+    cd_psr_cc_bits = CDxx_PSR & CDxx_PSR_CC_MASK;
+
+    WAIT_EDGE(dclk, dedge);
+
+    d = (CDxx_PSR & CDxx_PSR_CD_MASK) | cd_psr_cc_bits;
+
+    m = bus_match_p(&fetch, a, c, d);
+    if (follows ? (prev && !m) : m) {
+      counter = &histCycles[histRangeMap[unscramble_CAxx(a) & 0xffff]];
+    }
+    prev = m;
+    (*counter)++;
+
+    if ((++n & 4095) == 0 &&
+        counter_poll(start, histDuration, &reported, histReportInterval,
+            &histMillis, hist_report)) {
+      break;
+    }
+  }
+}
+
+// 6502, 65C02, 6800: address and control are valid on the rising
+// edge of PHI2, data on the falling edge.
+static void
+capture_phi2(void)
+{
+  capture_samples(CC_6502_PHI2_PIN, HIGH, CC_6502_PHI2_PIN, LOW);
+}
+
+// Watch kernel.  Keeps the last value read or written at each watched
+// address, and counts the reads and writes.  qual and edge_only are as
+// for capture_writes(); a Z80 access spans several samples, is counted
+// once, and its value is the one on the bus at the end of it.
+__attribute__((__always_inline__))
+static inline void
+watch_events(int aclk, int aedge, int dclk, int dedge, uint32_t qual, bool edge_only)
+{
+  struct bus_match rd, wr;
+  struct watch_slot *ws, *prev = NULL;
+  uint32_t a, c, d, cd_psr_cc_bits, addr, smask, sbits;
+  uint32_t amask = watchSpace == tr_io ? 0xff : 0xffff;
+  uint32_t start = millis(), reported = start;
+  uint32_t n = 0;
+  bool w;
+
+  smask = cpu_desc->space_mask;
+  sbits = watchSpace == tr_io ? cpu_desc->io_bits : cpu_desc->mem_bits;
+  encode_signals(cpu_desc->rw_mask | smask | qual,
+      cpu_desc->read_bits | sbits | qual, &rd);
+  encode_signals(cpu_desc->rw_mask | smask | qual,
+      cpu_desc->write_bits | sbits | qual, &wr);
+
+  while (true) {
+    WAIT_EDGE(aclk, aedge);
+
+    c = CCxx_PSR;
+    a = CAxx_PSR;
+    cd_psr_cc_bits = CDxx_PSR & CDxx_PSR_CC_MASK;
+
+    WAIT_EDGE(dclk, dedge);
 
-      // Check for Z80 /RESET or /INT active
-      if (cpu == cpu_z80) {
-        if (!(control[i] & CC_Z80_RESET)) {
-          COMMENT("RESET");
+    d = (CDxx_PSR & CDxx_PSR_CD_MASK) | cd_psr_cc_bits;
+
+    ws = NULL;
+    addr = unscramble_CAxx(a) & amask;
+    if ((watchMap[addr >> 3] & (1U << (addr & 7))) != 0) {
+      w = bus_match_p(&wr, a, c, d);
+      if (w || bus_match_p(&rd, a, c, d)) {
+        for (ws = watchSlots; ws->addr != addr; ws++) {
+          ;
         }
-        if (!(control[i] & CC_Z80_INT)) {
-          COMMENT("INT");
+        ws->value = unscramble_CDxx(d) & 0xff;
+        if (!edge_only || ws != prev || w != ws->written) {
+          if (w) {
+            ws->writes++;
+          } else {
+            ws->reads++;
+          }
         }
+        ws->written = w;
+        ws->valid = true;
       }
+    }
+    prev = ws;
 
-#undef COMMENT
+    if ((++n & 4095) == 0 &&
+        counter_poll(start, 0, &reported, WATCH_INTERVAL,
+            &watchMillis, watch_update)) {
+      break;
+    }
+  }
+}
 
-      // Indicate when trigger happened
-      if (i == triggerPoint) {
-        trig = "<--";
-      }
+// Branch trace kernel.  The opcode of each fetch gives the address of
+// the next one (traceLength); fetches that land there are only counted,
+// everything else that is interesting is stored.  If edge_only is set,
+// a bus cycle spans several samples (Z80 T states): a write is stored
+// from its first sample, and a fetch from its last, which is the first
+// one with the opcode on the bus.
+__attribute__((__always_inline__))
+static inline void
+trace_samples(int aclk, int aedge, int dclk, int dedge, bool edge_only)
+{
+  struct bus_match fetch, write;
+  const bool follows = cpu_desc->fetch_follows;
+  uint32_t a, c, d, cd_psr_cc_bits, pa;
+  uint32_t fa = 0, fc = 0, fd = 0, la = 0, lc = 0, ld = 0;
+  uint32_t expect = ~0U, from = 0, skipped = 0, len;
+  bool triggered = false, m, is_fetch, prev = false;
+  bool w, is_write, prev_write = false;
+  int i = 0;
+  const bool fast = trigFast;
+  const struct bus_match fm = trigFastMatch;
+
+  encode_signals(cpu_desc->fetch_mask, cpu_desc->fetch_bits, &fetch);
+  encode_signals(cpu_desc->rw_mask, cpu_desc->write_bits, &write);
+  traceCycles = 0;
+
+  while (true) {
+    WAIT_EDGE(aclk, aedge);
+
+    c = CCxx_PSR;
+    a = CAxx_PSR;
+    cd_psr_cc_bits = CDxx_PSR & CDxx_PSR_CC_MASK;
+
+    WAIT_EDGE(dclk, dedge);
 
-      // This printf format needs to be kept in sync with INSN_DECODE_MAXSTRING.
-      sprintf(output,
-          "%04lX  %-2s  %02lX  %-28s  %-3s  %s",
-          address[i], cycle, data[i], insn_decode_complete(&id),
-          trig, comment);
+    d = (CDxx_PSR & CDxx_PSR_CD_MASK) | cd_psr_cc_bits;
 
-      stream.println(output);
+    m = bus_match_p(&fetch, a, c, d);
+    if (edge_only) {
+      is_fetch = prev && !m;
+      fa = la;
+      fc = lc;
+      fd = ld;
+      la = a;
+      lc = c;
+      ld = d;
+    } else {
+      is_fetch = follows ? (prev && !m) : m;
+      fa = a;
+      fc = c;
+      fd = d;
     }
+    prev = m;
+    w = bus_match_p(&write, a, c, d);
+    is_write = w && !(edge_only && prev_write);
+    prev_write = w;
 
-    if (i == last) {
-      break;
+    if (!triggered) {
+      if (!triggerPressed && !trig_hit(fast, &fm, a, c, d)) {
+        continue;
+      }
+      triggered = true;
+      trigger_seen();
     }
+    traceCycles++;
 
-    i = (i + 1) % samples;
-    j++;
+    if (is_fetch) {
+      pa = unscramble_CAxx(fa) & 0xffff;
+      if (pa == expect && skipped < TRACE_SKIP_MAX) {
+        skipped++;
+      } else {
+        control[i] = fc;
+        address[i] = fa;
+        data[i] = fd;
+        recordInfo[i] = TRACE_FETCH | (skipped << TRACE_SKIP_SHIFT) | from;
+        skipped = 0;
+        if (++i == samples) {
+          break;
+        }
+      }
+      from = pa;
+      len = traceLength[unscramble_CDxx(fd) & 0xff];
+      expect = len != 0 ? (pa + len) & 0xffff : ~0U;
+    } else if (is_write) {
+      control[i] = c;
+      address[i] = a;
+      data[i] = d;
+      recordInfo[i] = (skipped << TRACE_SKIP_SHIFT) | from;
+      skipped = 0;
+      if (++i == samples) {
+        break;
+      }
+    }
   }
+  samplesTaken = i;
 }
 
-#define EXPORT_CC(s)  (control[i] & (s)) ? '1' : '0'
-
-const char *
-exportCSV_header_6502(void)
+static void
+writes_phi2(void)
 {
-  return "Index,Trigger,SYNC,R/W,/RESET,/IRQ,/NMI,Address,Data";
+  capture_writes(CC_6502_PHI2_PIN, HIGH, CC_6502_PHI2_PIN, LOW, 0, false);
 }
 
-void
-exportCSV_entry_6502(int i, int j, char *output)
+// The 6800 has VMA, and a write cycle without it isn't real.
+static void
+writes_6800(void)
 {
-  sprintf(output, "%d,%d,%c,%c,%c,%c,%c,%04lX,%02lX", j, i == triggerPoint,
-      EXPORT_CC(CC_6502_SYNC),
-      EXPORT_CC(CC_6502_RW),
-      EXPORT_CC(CC_6502_RESET),
-      EXPORT_CC(CC_6502_IRQ),
-      EXPORT_CC(CC_6502_NMI),
-      address[i], data[i]);
+  capture_writes(CC_6502_PHI2_PIN, HIGH, CC_6502_PHI2_PIN, LOW, CC_6800_VMA, false);
 }
 
-const char *
-exportCSV_header_6800(void)
+static void
+compress_phi2(void)
 {
-  return "Index,Trigger,VMA,R/W,/RESET,/IRQ,/NMI,Address,Data";
+  capture_compressed(CC_6502_PHI2_PIN, HIGH, CC_6502_PHI2_PIN, LOW);
 }
 
-void
-exportCSV_entry_6800(int i, int j, char *output)
+static void
+watch_phi2(void)
 {
-  sprintf(output, "%d,%d,%c,%c,%c,%c,%c,%04lX,%02lX", j, i == triggerPoint,
-      EXPORT_CC(CC_6800_VMA),
-      EXPORT_CC(CC_6800_RW),
-      EXPORT_CC(CC_6800_RESET),
-      EXPORT_CC(CC_6800_IRQ),
-      EXPORT_CC(CC_6800_NMI),
-      address[i], data[i]);
+  watch_events(CC_6502_PHI2_PIN, HIGH, CC_6502_PHI2_PIN, LOW, 0, false);
 }
 
-const char *
-exportCSV_header_6809(void)
+static void
+watch_6800(void)
 {
-  return "Index,Trigger,BA,BS,R/W,/RESET,/IRQ,/FIRQ,/NMI,Address,Data";
+  watch_events(CC_6502_PHI2_PIN, HIGH, CC_6502_PHI2_PIN, LOW, CC_6800_VMA, false);
 }
 
-void
-exportCSV_entry_6809(int i, int j, char *output)
+static void
+count_phi2(void)
 {
-  sprintf(output, "%d,%d,%c,%c,%c,%c,%c,%c,%c,%04lX,%02lX",j, i == triggerPoint,
-      EXPORT_CC(CC_6809_BA),
-      EXPORT_CC(CC_6809_BS),
-      EXPORT_CC(CC_6809_RW),
-      EXPORT_CC(CC_6809_RESET),
-      EXPORT_CC(CC_6809_IRQ),
-      EXPORT_CC(CC_6809_FIRQ),
-      EXPORT_CC(CC_6809_NMI),
-      address[i], data[i]);
+  count_events(CC_6502_PHI2_PIN, HIGH, CC_6502_PHI2_PIN, LOW);
 }
 
-const char *
-exportCSV_header_6809e(void)
+static void
+histogram_phi2(void)
 {
-  return "Index,Trigger,BA,BS,LIC,R/W,/RESET,/IRQ,/FIRQ,/NMI,Address,Data";
+  histogram_events(CC_6502_PHI2_PIN, HIGH, CC_6502_PHI2_PIN, LOW);
 }
 
-void
-exportCSV_entry_6809e(int i, int j, char *output)
+static void
+trace_phi2(void)
 {
-  sprintf(output, "%d,%d,%c,%c,%c,%c,%c,%c,%c,%c,%04lX,%02lX", j, i == triggerPoint,
-      EXPORT_CC(CC_6809_BA),
-      EXPORT_CC(CC_6809_BS),
-      EXPORT_CC(CC_6809E_LIC),
-      EXPORT_CC(CC_6809_RW),
-      EXPORT_CC(CC_6809_RESET),
-      EXPORT_CC(CC_6809_IRQ),
-      EXPORT_CC(CC_6809_FIRQ),
-      EXPORT_CC(CC_6809_NMI),
-      address[i], data[i]);
+  trace_samples(CC_6502_PHI2_PIN, HIGH, CC_6502_PHI2_PIN, LOW, false);
 }
 
-const char *
-exportCSV_header_z80(void)
+// 6809, 6809E: address and control are valid on the rising edge
+// of Q, data on the falling edge of E.
+static void
+capture_6809(void)
 {
-  return "Index,Trigger,/M1,/RD,/WR,/MREQ,/IORQ,/RESET,/INT,Address,Data";
+  capture_samples(CC_6809_Q_PIN, HIGH, CC_6809_E_PIN, LOW);
 }
 
-void
-exportCSV_entry_z80(int i, int j, char *output)
+static void
+writes_6809(void)
 {
-  sprintf(output, "%d,%d,%c,%c,%c,%c,%c,%c,%c,%04lX,%02lX", j, i == triggerPoint,
-      EXPORT_CC(CC_Z80_M1),
-      EXPORT_CC(CC_Z80_RD),
-      EXPORT_CC(CC_Z80_WR),
-      EXPORT_CC(CC_Z80_MREQ),
-      EXPORT_CC(CC_Z80_IORQ),
-      EXPORT_CC(CC_Z80_RESET),
-      EXPORT_CC(CC_Z80_INT),
-      address[i], data[i]);
+  capture_writes(CC_6809_Q_PIN, HIGH, CC_6809_E_PIN, LOW, 0, false);
 }
 
-#undef EXPORT_CCC
+static void
+compress_6809(void)
+{
+  capture_compressed(CC_6809_Q_PIN, HIGH, CC_6809_E_PIN, LOW);
+}
 
-// Show the recorded data in CSV format (e.g. to export to spreadsheet or other program).
-void
-exportCSV(Stream &stream, int validSamples)
+static void
+watch_6809(void)
 {
-  void (*export_entry)(int, int, char *);
-  const char *header;
-  char output[50];
+  watch_events(CC_6809_Q_PIN, HIGH, CC_6809_E_PIN, LOW, 0, false);
+}
 
-  if (validSamples == 0) {
-      return;
-  }
+static void
+count_6809(void)
+{
+  count_events(CC_6809_Q_PIN, HIGH, CC_6809_E_PIN, LOW);
+}
 
-  // Output header
-  switch (cpu) {
-    case cpu_6502:
-    case cpu_65c02:
-      header = exportCSV_header_6502();
-      export_entry = exportCSV_entry_6502;
-      break;
+static void
+histogram_6809(void)
+{
+  histogram_events(CC_6809_Q_PIN, HIGH, CC_6809_E_PIN, LOW);
+}
 
-    case cpu_6809:
-      header = exportCSV_header_6809();
-      export_entry = exportCSV_entry_6809;
-      break;
+static void
+trace_6809(void)
+{
+  trace_samples(CC_6809_Q_PIN, HIGH, CC_6809_E_PIN, LOW, false);
+}
 
-    case cpu_6809e:
-      header = exportCSV_header_6809e();
-      export_entry = exportCSV_entry_6809e;
-      break;
+// Z80: address and control are valid on the falling edge of CLK,
+// data on the rising edge.
+static void
+capture_z80(void)
+{
+  capture_samples(CC_Z80_CLK_PIN, LOW, CC_Z80_CLK_PIN, HIGH);
+}
 
-    case cpu_6800:
-      header = exportCSV_header_6800();
-      export_entry = exportCSV_entry_6800;
-      break;
+// /WR stays asserted for several clocks, so only its leading edge counts.
+static void
+writes_z80(void)
+{
+  capture_writes(CC_Z80_CLK_PIN, LOW, CC_Z80_CLK_PIN, HIGH, 0, true);
+}
 
-    case cpu_z80:
-      header = exportCSV_header_z80();
-      export_entry = exportCSV_entry_z80;
-      break;
+// Wait states repeat the T state before them.
+static void
+compress_z80(void)
+{
+  capture_compressed(CC_Z80_CLK_PIN, LOW, CC_Z80_CLK_PIN, HIGH);
+}
 
-    default:
-      return;
-  }
-  stream.println(header);
+static void
+watch_z80(void)
+{
+  watch_events(CC_Z80_CLK_PIN, LOW, CC_Z80_CLK_PIN, HIGH, 0, true);
+}
 
-  int first = (triggerPoint - pretrigger + samples) % samples;
-  int last = (triggerPoint - pretrigger + samples - 1) % samples;
+static void
+count_z80(void)
+{
+  count_events(CC_Z80_CLK_PIN, LOW, CC_Z80_CLK_PIN, HIGH);
+}
 
-  // Display data
-  int i = first;
-  int j = 0;
-  while (true) {
-    (*export_entry)(i, j, output);
-    stream.println(output);
+static void
+histogram_z80(void)
+{
+  histogram_events(CC_Z80_CLK_PIN, LOW, CC_Z80_CLK_PIN, HIGH);
+}
 
-    if (i == last) {
-      break;
-    }
+static void
+trace_z80(void)
+{
+  trace_samples(CC_Z80_CLK_PIN, LOW, CC_Z80_CLK_PIN, HIGH, true);
+}
 
-    i = (i + 1) % samples;
-    j++;
+//
+// Bus cycle classifiers.  Classifiers are called on each sample in
+// order; *statep is zeroed before the first call and can be used to
+// carry state from one sample to the next.
+//
+static bus_cycle_t
+classify_6502(int i, uint32_t *statep)
+{
+  // 6502 SYNC high indicates opcode/instruction fetch, otherwise
+  // show as read or write.
+  if (control[i] & CC_6502_SYNC) {
+    return bc_fetch;
   }
+  return (control[i] & CC_6502_RW) ? bc_read : bc_write;
 }
 
-
-// Write the recorded data to files on the internal SD card slot.
-void
-writeSD(void)
+static bus_cycle_t
+classify_6800(int i, uint32_t *statep)
 {
-  const char *CSV_FILE = "analyzer.csv";
-  const char *TXT_FILE = "analyzer.txt";
-
-  if (cpu == cpu_none || samplesTaken == 0) {
-    tla_printf("No samples to save.\n");
-    return;
+  // VMA R/W
+  //  0   X  Internal cycle
+  //  1   0  Memory read
+  //  1   1  Memory write
+  if (!(control[i] & CC_6800_VMA)) {
+    return bc_dummy;
   }
+  return (control[i] & CC_6800_RW) ? bc_read : bc_write;
+}
 
-  if (!SD.begin(BUILTIN_SDCARD)) {
-    tla_printf("Unable to initialize internal SD card.\n");
-    return;
+static bus_cycle_t
+classify_6809(int i, uint32_t *statep)
+{
+  // 6809 doens't have a VMA signal like the 6800, but the
+  // data sheet describes how to detect a so-called "dummy
+  // cycle" (which is also calls "/VMA").
+  if (address[i] == 0xffff &&
+      (control[i] & (CC_6809_RW | CC_6809_BS)) == CC_6809_RW) {
+    return bc_dummy;
   }
+  return (control[i] & CC_6809_RW) ? bc_read : bc_write;
+}
 
-  // Remove any existing file
-  if (SD.exists(CSV_FILE)) {
-    SD.remove(CSV_FILE);
+static bus_cycle_t
+classify_6809e(int i, uint32_t *statep)
+{
+  bus_cycle_t rv;
+
+  // Get the current status of LIC.  Note that LIC will also
+  // be high while the processor is in SYNC state or while
+  // stacking registers during an interrupt.
+  bool have_lic = (control[i] & CC_6809E_LIC) != 0;
+
+  rv = classify_6809(i, statep);
+  if (rv == bc_read) {
+    // If we saw LIC on the previous cycle, then this is an insn
+    // fetch.  Don't treat it as part of an instruction if it looks
+    // like we're doing a vector fetch, though.
+    if (address[i] >= 0xfff0) {
+      rv = bc_vector;
+    } else if (*statep && !have_lic) {
+      // Even if we have seen LIC go by, it's not an
+      // instruction fetch until LIC goes low.
+      rv = bc_fetch;
+      *statep = 0;
+    }
   }
-
-  File file = SD.open(CSV_FILE, FILE_WRITE);
-  if (file) {
-    tla_printf("Writing %s\n", CSV_FILE);
-    exportCSV(file, samplesTaken);
-    file.close();
-  } else {
-    tla_printf("Unable to write %s\n", CSV_FILE);
+  if (have_lic) {
+    *statep = 1;
   }
+  return rv;
+}
 
-  // Remove any existing file
-  if (SD.exists(TXT_FILE)) {
-    SD.remove(TXT_FILE);
+static bus_cycle_t
+classify_z80(int i, uint32_t *statep)
+{
+  // /M1 /MREQ  /IORQ /RD /WR
+  //  1    0      1    0   1   Memory read
+  //  1    0      1    1   0   Memory write
+  //  0    0      1    0   1   Instruction fetch
+  //  1    1      0    0   1   I/O read
+  //  1    1      0    1   0   I/O write
+
+  if (!(control[i] & CC_Z80_M1)) {
+    return bc_fetch;
+  } else if (!(control[i] & CC_Z80_MREQ) && !(control[i] & CC_Z80_RD)) {
+    return bc_read;
+  } else if (!(control[i] & CC_Z80_MREQ) && !(control[i] & CC_Z80_WR)) {
+    return bc_write;
+  } else if (!(control[i] & CC_Z80_IORQ) && !(control[i] & CC_Z80_RD)) {
+    return bc_io_read;
+  } else if (!(control[i] & CC_Z80_IORQ) && !(control[i] & CC_Z80_WR)) {
+    return bc_io_write;
   }
+  return bc_none;
+}
 
-  file = SD.open(TXT_FILE, FILE_WRITE);
-  if (file) {
-    tla_printf("Writing %s\n", TXT_FILE);
-    list(file, 0, samples - 1, samplesTaken);
-    file.close();
-  } else {
-    tla_printf("Unable to write %s\n", TXT_FILE);
+const char *
+bus_cycle_name(bus_cycle_t bc)
+{
+  switch (bc) {
+    case bc_fetch:      return "F";
+    case bc_read:       return "R";
+    case bc_write:      return "W";
+    case bc_dummy:      return "-";
+    case bc_io_read:    return "IR";
+    case bc_io_write:   return "IW";
+    case bc_vector:     return "R";
+    default:            return "";
   }
 }
 
+const struct cpu_signal signals_6502[] = {
+  { "SYNC",     CC_6502_SYNC,   false,  true,   NULL },
+  { "R/W",      CC_6502_RW,     false,  true,   NULL },
+  { "/RESET",   CC_6502_RESET,  true,   true,   "RESET" },
+  { "/IRQ",     CC_6502_IRQ,    true,   true,   "IRQ" },
+  { "/NMI",     CC_6502_NMI,    true,   true,   "NMI" },
+  { "PHI2",     CC_6502_PHI2,   false,  false,  NULL },
+  { "PHI1",     CC_6502_PHI1,   false,  false,  NULL },
+  { "RDY",      CC_6502_RDY,    false,  false,  NULL },
+  { "/SO",      CC_6502_SO,     true,   false,  NULL },
+  { NULL },
+};
 
-// Start recording.
-void
-go(void)
-{
-  aTriggerBits = 0;
-  aTriggerMask = 0;
-  dTriggerBits = 0;
-  dTriggerMask = 0;
-  cTriggerBits = 0;
-  cTriggerMask = 0;
+const struct cpu_region regions_6502[] = {
+  { 0xfffa, 0xfffb, "NMI VECTOR" },
+  { 0xfffc, 0xfffd, "RESET VECTOR" },
+  { 0xfffe, 0xffff, "IRQ/BRK VECTOR" },
+  { 0x0100, 0x01ff, "STACK ACCESS" },
+  { 0, 0, NULL },
+};
 
-  uint32_t which_c_trigger = 0;
-  uint32_t cd_psr_cc_bits;
+const struct cpu_signal signals_6800[] = {
+  { "VMA",      CC_6800_VMA,    false,  true,   NULL },
+  { "R/W",      CC_6800_RW,     false,  true,   NULL },
+  { "/RESET",   CC_6800_RESET,  true,   true,   "RESET" },
+  { "/IRQ",     CC_6800_IRQ,    true,   true,   "IRQ" },
+  { "/NMI",     CC_6800_NMI,    true,   true,   "NMI" },
+  { "PHI2",     CC_6800_PHI2,   false,  false,  NULL },
+  { "PHI1",     CC_6800_PHI1,   false,  false,  NULL },
+  { "/HALT",    CC_6800_HALT,   true,   false,  NULL },
+  { "DBE",      CC_6800_DBE,    false,  false,  NULL },
+  { "BA",       CC_6800_BA,     false,  false,  NULL },
+  { "TSC",      CC_6800_TSC,    false,  false,  NULL },
+  { NULL },
+};
 
-  if (cpu == cpu_none) {
-    tla_printf("No CPU type selected!\n");
-  }
+const struct cpu_region regions_6800[] = {
+  { 0xfff8, 0xfff9, "IRQ VECTOR" },
+  { 0xfffa, 0xfffb, "SWI VECTOR" },
+  { 0xfffc, 0xfffd, "NMI VECTOR" },
+  // Not 0xffff since it commonly occurs when bus is tri-state
+  { 0xfffe, 0xfffe, "RESET VECTOR" },
+  { 0, 0, NULL },
+};
 
-  // Scramble the trigger address, control, and data lines to match what we will read on the ports.
+const struct cpu_signal signals_6809[] = {
+  { "BA",       CC_6809_BA,       false,  true,   NULL },
+  { "BS",       CC_6809_BS,       false,  true,   NULL },
+  { "R/W",      CC_6809_RW,       false,  true,   NULL },
+  { "/RESET",   CC_6809_RESET,    true,   true,   "RESET" },
+  { "/IRQ",     CC_6809_IRQ,      true,   true,   "IRQ" },
+  { "/FIRQ",    CC_6809_FIRQ,     true,   true,   "FIRQ" },
+  { "/NMI",     CC_6809_NMI,      true,   true,   "NMI" },
+  { "E",        CC_6809_E,        false,  false,  NULL },
+  { "Q",        CC_6809_Q,        false,  false,  NULL },
+  { "MRDY",     CC_6809_MRDY,     false,  false,  NULL },
+  { "/DMA",     CC_6809_DMA_BREQ, true,   false,  NULL },
+  { "/HALT",    CC_6809_HALT,     true,   false,  NULL },
+  { NULL },
+};
 
-  if (triggerMode == tr_address || triggerMode == tr_data || triggerMode == tr_addr_data) {
+const struct cpu_signal signals_6809e[] = {
+  { "BA",       CC_6809_BA,       false,  true,   NULL },
+  { "BS",       CC_6809_BS,       false,  true,   NULL },
+  { "LIC",      CC_6809E_LIC,     false,  true,   NULL },
+  { "R/W",      CC_6809_RW,       false,  true,   NULL },
+  { "/RESET",   CC_6809_RESET,    true,   true,   "RESET" },
+  { "/IRQ",     CC_6809_IRQ,      true,   true,   "IRQ" },
+  { "/FIRQ",    CC_6809_FIRQ,     true,   true,   "FIRQ" },
+  { "/NMI",     CC_6809_NMI,      true,   true,   "NMI" },
+  { "E",        CC_6809_E,        false,  false,  NULL },
+  { "Q",        CC_6809_Q,        false,  false,  NULL },
+  { "TSC",      CC_6809E_TSC,     false,  false,  NULL },
+  { "AVMA",     CC_6809E_AVMA,    false,  false,  NULL },
+  { "BUSY",     CC_6809E_BUSY,    false,  false,  NULL },
+  { "/HALT",    CC_6809_HALT,     true,   false,  NULL },
+  { NULL },
+};
 
-    if (triggerMode == tr_address || triggerMode == tr_addr_data) {
-      aTriggerBits = scramble_CAxx(triggerAddress);
-      if (triggerSpace == tr_io) {
-        aTriggerMask = scramble_CAxx(0xff);
-      } else {
-        aTriggerMask = scramble_CAxx(0xffff);
-      }
-    }
-    if (triggerMode == tr_data || triggerMode == tr_addr_data) {
-      dTriggerBits = scramble_CDxx(triggerData);
-      dTriggerMask = scramble_CDxx(0xff);
-    }
-
-    // Check for r/w qualifer
-    if (cpu != cpu_z80) {
-      // 6502, 6800, 6809 -- all 6800-like
-      cTriggerMask = scramble_CCxx(CC_6800_RW, &aTriggerMask, &dTriggerMask);
-      if (triggerCycle == tr_read) {
-        cTriggerBits = scramble_CCxx(CC_6800_RW, &aTriggerBits, &dTriggerBits);
-      }
-    } else {
-      uint32_t tmask, tbits;
-
-      tmask = CC_Z80_MREQ | CC_Z80_IORQ;
-      if (triggerSpace == tr_io) {
-        tbits = CC_Z80_MREQ;              // I/O cycle
-      } else {
-        tbits = CC_Z80_IORQ;              // Memory cycle
-      }
-      if (triggerCycle == tr_read) {
-        tmask |= CC_Z80_RD | CC_Z80_WR;
-        tbits |= CC_Z80_WR;               // Read cycle
-      } else if (triggerCycle == tr_write) {
-        tmask |= CC_Z80_RD | CC_Z80_WR;
-        tbits |= CC_Z80_RD;               // Write cycle
-      }
-      cTriggerMask = scramble_CCxx(tmask, &aTriggerMask, &dTriggerMask);
-      cTriggerBits = scramble_CCxx(tbits, &aTriggerBits, &dTriggerBits);
-    }
-
-  } else if (triggerMode == tr_reset) {
-    if (cpu != cpu_z80) {
-      // 6502, 6800, 6809 -- all 6800-like
-      which_c_trigger = CC_6800_RESET;
-    } else {
-      which_c_trigger = CC_Z80_RESET;
-    }
-  } else if (triggerMode == tr_irq) {
-    if (cpu != cpu_z80) {
-      // 6502, 6800, 6809 -- all 6800-like
-      which_c_trigger = CC_6800_IRQ;
-    } else {
-      which_c_trigger = CC_Z80_INT;
-    }
-  } else if (triggerMode == tr_firq) {
-    if (cpu == cpu_6809 || cpu == cpu_6809e) {
-      which_c_trigger = CC_6809_FIRQ;
-    }
-  } else if (triggerMode == tr_nmi) {
-    if (cpu != cpu_z80) {
-      // 6502, 6800, 6809 -- all 6800-like
-      which_c_trigger = CC_6800_NMI;
-    } else {
-      which_c_trigger = CC_Z80_NMI;
-    }
-  }
-  // TODO: Add support other Z80 control line triggers.
-
-  // If a control signal trigger was specified, encode it.
-  if (which_c_trigger) {
-    cTriggerMask = scramble_CCxx(which_c_trigger, &aTriggerMask, &dTriggerMask);
-    if (triggerLevel) {
-      cTriggerBits = scramble_CCxx(which_c_trigger, &aTriggerBits, &dTriggerBits);
-    }
-  }
-
-  tla_printf("Waiting for trigger...\n");
-
-  // tr_none is like the button is pressed instantly.
-  triggerPressed = triggerMode == tr_none;
-
-  setBusEnabled(true);
-  digitalWriteFast(CORE_LED0_PIN, HIGH); // Indicates waiting for trigger
+const struct cpu_region regions_6809[] = {
+  { 0xfff2, 0xfff3, "SWI3 VECTOR" },
+  { 0xfff4, 0xfff5, "SWI2 VECTOR" },
+  { 0xfff6, 0xfff7, "FIRQ VECTOR" },
+  { 0xfff8, 0xfff9, "IRQ VECTOR" },
+  { 0xfffa, 0xfffb, "SWI VECTOR" },
+  { 0xfffc, 0xfffd, "NMI VECTOR" },
+  // Not 0xffff since it commonly occurs when bus is tri-state
+  { 0xfffe, 0xfffe, "RESET VECTOR" },
+  { 0, 0, NULL },
+};
 
-  int i = 0; // Index into data buffers
-  bool triggered = false; // Set when triggered
+const struct cpu_signal signals_z80[] = {
+  { "/M1",      CC_Z80_M1,      true,   true,   NULL },
+  { "/RD",      CC_Z80_RD,      true,   true,   NULL },
+  { "/WR",      CC_Z80_WR,      true,   true,   NULL },
+  { "/MREQ",    CC_Z80_MREQ,    true,   true,   NULL },
+  { "/IORQ",    CC_Z80_IORQ,    true,   true,   NULL },
+  { "/RESET",   CC_Z80_RESET,   true,   true,   "RESET" },
+  { "/INT",     CC_Z80_INT,     true,   true,   "INT" },
+  { "CLK",      CC_Z80_CLK,     false,  false,  NULL },
+  { "/NMI",     CC_Z80_NMI,     true,   false,  NULL },
+  { "/BUSACK",  CC_Z80_BUSACK,  true,   false,  NULL },
+  { "/BUSRQ",   CC_Z80_BUSRQ,   true,   false,  NULL },
+  { "/WAIT",    CC_Z80_WAIT,    true,   false,  NULL },
+  { "/HALT",    CC_Z80_HALT,    true,   false,  NULL },
+  { "/RFSH",    CC_Z80_RFSH,    true,   false,  NULL },
+  { NULL },
+};
 
-  samplesTaken = 0;
+const struct cpu_region regions_z80[] = {
+  { 0, 0, NULL },
+};
 
-  while (true) {
+const struct cpu_descriptor cpu_descriptors[] = {
+  { "6502",   cpu_6502,   false,
+    capture_phi2,   count_phi2,     histogram_phi2, trace_phi2,
+    writes_phi2,    watch_phi2,  compress_phi2,
+    classify_6502,  insn_decode_next_state_6502, insn_decode_illegal_6502,
+    signals_6502,   regions_6502,
+    CC_6502_RESET,  CC_6502_IRQ,      0,              CC_6502_NMI,
+    0,              0,                0,
+    CC_6502_RW,     CC_6502_RW,       0,
+    0,              0,                0xfffa,         0xffff,
+    CC_6502_SYNC,   CC_6502_SYNC,     false,
+    0,              0 },
+
+  { "65C02",  cpu_65c02,  false,
+    capture_phi2,   count_phi2,     histogram_phi2, trace_phi2,
+    writes_phi2,    watch_phi2,  compress_phi2,
+    classify_6502,  insn_decode_next_state_6502, insn_decode_illegal_6502,
+    signals_6502,   regions_6502,
+    CC_6502_RESET,  CC_6502_IRQ,      0,              CC_6502_NMI,
+    0,              0,                0,
+    CC_6502_RW,     CC_6502_RW,       0,
+    0,              0,                0xfffa,         0xffff,
+    CC_6502_SYNC,   CC_6502_SYNC,     false,
+    0,              0 },
+
+  { "6800",   cpu_6800,   false,
+    capture_phi2,   count_phi2,     histogram_phi2, trace_phi2,
+    writes_6800,    watch_6800,  compress_phi2,
+    classify_6800,  insn_decode_next_state_6800, insn_decode_illegal_6800,
+    signals_6800,   regions_6800,
+    CC_6800_RESET,  CC_6800_IRQ,      0,              CC_6800_NMI,
+    0,              0,                0,
+    CC_6800_RW,     CC_6800_RW,       0,
+    0,              0,                0xfff8,         0xfffd,
+    0,              0,                false,
+    CC_6800_BA,     CC_6800_BA },
+
+  // 6809 BA low with BS high is an interrupt (or reset) acknowledge.
+  // BA high (SYNC, HALT or DMA) means the bus is free.
+  { "6809",   cpu_6809,   false,
+    capture_6809,   count_6809,     histogram_6809, trace_6809,
+    writes_6809,    watch_6809,  compress_6809,
+    classify_6809,  insn_decode_next_state_6809, insn_decode_illegal_6809,
+    signals_6809,   regions_6809,
+    CC_6809_RESET,  CC_6809_IRQ,      CC_6809_FIRQ,   CC_6809_NMI,
+    0,              0,                0,
+    CC_6809_RW,     CC_6809_RW,       0,
+    CC_6809_BA | CC_6809_BS,          CC_6809_BS,     0,      0,
+    0,              0,                false,
+    CC_6809_BA,     CC_6809_BA },
+
+  // The 6809E's LIC goes high for the last cycle of each instruction.
+  { "6809E",  cpu_6809e,  false,
+    capture_6809,   count_6809,     histogram_6809, trace_6809,
+    writes_6809,    watch_6809,  compress_6809,
+    classify_6809e, insn_decode_next_state_6809, insn_decode_illegal_6809,
+    signals_6809e,  regions_6809,
+    CC_6809_RESET,  CC_6809_IRQ,      CC_6809_FIRQ,   CC_6809_NMI,
+    0,              0,                0,
+    CC_6809_RW,     CC_6809_RW,       0,
+    CC_6809_BA | CC_6809_BS,          CC_6809_BS,     0,      0,
+    CC_6809E_LIC,   CC_6809E_LIC,     true,
+    CC_6809_BA,     CC_6809_BA },
+
+  // Z80 control signals are all active-low: a memory cycle has
+  // /MREQ asserted and /IORQ not, a read cycle has /RD asserted
+  // and /WR not, etc.  /M1 together with /IORQ is an interrupt
+  // acknowledge, and /M1 together with /MREQ an opcode fetch.  Every
+  // opcode byte is defined; the undefined instructions follow a prefix.
+  { "Z80",    cpu_z80,    true,
+    capture_z80,    count_z80,      histogram_z80,  trace_z80,
+    writes_z80,     watch_z80,  compress_z80,
+    classify_z80,   insn_decode_next_state_z80, NULL,
+    signals_z80,    regions_z80,
+    CC_Z80_RESET,   CC_Z80_INT,       0,              CC_Z80_NMI,
+    CC_Z80_MREQ | CC_Z80_IORQ,        CC_Z80_IORQ,    CC_Z80_MREQ,
+    CC_Z80_RD | CC_Z80_WR,            CC_Z80_WR,      CC_Z80_RD,
+    CC_Z80_M1 | CC_Z80_IORQ,          0,              0,      0,
+    CC_Z80_M1 | CC_Z80_MREQ,          0,              false,
+    CC_Z80_HALT,    0 },
 
-    if ((cpu == cpu_65c02) || (cpu == cpu_6502) || (cpu == cpu_6800)) {
-      // Wait for PHI2 to go from low to high
-      WAIT_PHI2_LOW;
-      WAIT_PHI2_HIGH;
-    }
-    if (cpu == cpu_6809 || cpu == cpu_6809e) {
-      // Wait for Q to go from low to high
-      WAIT_Q_LOW;
-      WAIT_Q_HIGH;
-    }
-    if (cpu == cpu_z80) {
-      // Wait CLK to go from high to low
-      WAIT_CLK_HIGH;
-      WAIT_CLK_LOW;
-    }
+  { NULL },
+};
 
-    // Read address and control lines.  Note that some of the control
-    // lines are in the CDxx_PSR, and we need to extract those as well.
-    control[i] = CCxx_PSR;
-    address[i] = CAxx_PSR;
-    cd_psr_cc_bits = CDxx_PSR & CDxx_PSR_CC_MASK;
+const struct cpu_descriptor *
+cpu_lookup(cpu_t c)
+{
+  const struct cpu_descriptor *d;
 
-    if ((cpu == cpu_65c02) || (cpu == cpu_6502) || (cpu == cpu_6800)) {
-      // Wait for PHI2 to go from high to low
-      WAIT_PHI2_HIGH;
-      WAIT_PHI2_LOW;
-    }
-    if (cpu == cpu_6809 || cpu == cpu_6809e) {
-      // Wait for E to go from high to low
-      WAIT_E_HIGH;
-      WAIT_E_LOW;
-    }
-    if (cpu == cpu_z80) {
-      // Wait CLK to go from low to high
-      WAIT_CLK_LOW;
-      WAIT_CLK_HIGH;
+  for (d = cpu_descriptors; d->name != NULL; d++) {
+    if (d->type == c) {
+      return d;
     }
+  }
+  return NULL;
+}
 
-    // Read data lines.  Mask out the control bits on this
-    // read and mix in the control bits read above.
-    data[i] = (CDxx_PSR & CDxx_PSR_CD_MASK) | cd_psr_cc_bits;
+bool
+cpu_has_iospace(cpu_t c)
+{
+  const struct cpu_descriptor *d = cpu_lookup(c);
 
-    // Set triggered flag if trigger button pressed or trigger seen
-    // If triggered, increment buffer index
-    if (!triggered) {
-      if (triggerPressed ||
-          (((address[i] & aTriggerMask) == (aTriggerBits & aTriggerMask)) &&
-           ((data[i] & dTriggerMask) == (dTriggerBits & dTriggerMask)) &&
-           ((control[i] & cTriggerMask) == (cTriggerBits & cTriggerMask)))) {
-        triggered = true;
-        triggerPoint = i;
-        digitalWriteFast(CORE_LED0_PIN, LOW); // Indicates received trigger
-      }
-    }
+  return d != NULL && d->has_iospace;
+}
 
-    // Count number of samples taken after trigger
-    if (triggered) {
-      samplesTaken++;
-    }
+const struct cpu_signal *
+cpu_signal_lookup(uint32_t mask)
+{
+  const struct cpu_signal *sig;
 
-    // Exit when buffer is full of samples
-    if (samplesTaken >= (samples - pretrigger)) {
-      break;
+  if (cpu_desc == NULL || mask == 0) {
+    return NULL;
+  }
+  for (sig = cpu_desc->signals; sig->name != NULL; sig++) {
+    if (sig->mask == mask) {
+      return sig;
     }
-
-    i = (i + 1) % samples; // Increment index, wrapping around at end for circular buffer
   }
-
-  setBusEnabled(false);
-
-  tla_printf("Data recorded (%d samples).\n", samples);
-  unscramble();
+  return NULL;
 }
 
 bool
-parseHexNumber(char *cp, uint32_t *valp)
+cpu_signal_asserted(const struct cpu_signal *sig, uint32_t ctl)
 {
-  char *endptr = NULL;
+  return ((ctl & sig->mask) != 0) != sig->active_low;
+}
 
-  if (cp[0] == '0' && (cp[1] == 'x' || cp[1] == 'X')) {
-    cp += 2;
-  } else if (cp[0] == '$') {
-    cp++;
-  } else {
-    size_t len = strlen(cp);
-    if (len != 0 && (cp[len - 1] == 'h' || cp[len - 1] == 'H')) {
-      cp[len - 1] = '\0';
-    }
+// Returns true if sample i is the CPU acknowledging an interrupt.
+bool
+cpu_int_ack(int i)
+{
+  if (cpu_desc->ack_mask != 0) {
+    return (control[i] & cpu_desc->ack_mask) == cpu_desc->ack_bits;
   }
+  return (control[i] & cpu_desc->rw_mask) == cpu_desc->read_bits &&
+         address[i] >= cpu_desc->vec_first && address[i] <= cpu_desc->vec_last;
+}
 
-  int rv = strtol(cp, &endptr, 16);
-  if (endptr[0] != '\0') {
-    return false;
-  }
-  *valp = rv;
-  return true;
+const char *
+cpu_name(void)
+{
+  return cpu_desc != NULL ? cpu_desc->name : "not set";
 }
 
-bool
-parseDecimalNumber(char *cp, int *valp)
+void
+show_cpu(void)
 {
-  char *endptr = NULL;
+  tla_printf("CPU: %s\n", cpu_name());
+}
 
-  int rv = strtol(cp, &endptr, 10);
-  if (endptr[0] != '\0') {
-    return false;
+void
+set_cpu(cpu_t ncpu)
+{
+  if (triggerSpace == tr_io && !cpu_has_iospace(ncpu)) {
+    triggerSpace = tr_mem;
+    triggerMode = tr_none;
   }
-  *valp = rv;
-  return true;
+  if (ncpu != cpu) {
+    // Signal columns and counter terms refer to the old CPU's
+    // signals, and the soak statistics and static listing are only
+    // meaningful for one CPU.
+    exportColumnCount = 0;
+    soak_reset();
+    countTermCount = 0;
+    code_clear();
+  }
+  cpu = ncpu;
+  cpu_desc = cpu_lookup(ncpu);
+  memset(illegalMap, 0, sizeof(illegalMap));
+  if (cpu_desc != NULL && cpu_desc->illegal != NULL) {
+    (*cpu_desc->illegal)(illegalMap);
+  }
+  list_reset();
 }
 
+// The illegal opcode trigger needs to know which cycles are opcode
+// fetches, and opcodes that can be illegal.
 bool
-parseAddress(char *cp, space_t space, uint32_t *addrp)
+illegal_trigger_valid(void)
 {
-  uint32_t maxaddr = space == tr_io ? 0xff : 0xffff;
-  uint32_t val;
+  int i;
 
-  if (! parseHexNumber(cp, &val) || val > maxaddr) {
-    tla_printf("Invalid address.\n");
+  if (cpu_desc == NULL || cpu_desc->fetch_mask == 0) {
     return false;
   }
-  *addrp = val;
-  return true;
+  for (i = 0; i < INSN_ILLEGAL_MAP_SIZE; i++) {
+    if (illegalMap[i] != 0) {
+      return true;
+    }
+  }
+  return false;
 }
 
-int
-stringMatch(const char *match, const char *user)
+// Returns the control signal used for a signal trigger, or 0 if the
+// current CPU doesn't have one.
+uint32_t
+trigger_signal(trigger_t t)
 {
-  int rv = 0;
-  size_t matchlen = strlen(match);
-  size_t userlen = strlen(user);
-
-  if (matchlen == userlen) {
-    if (strcmp(match, user) == 0) {
-      return (int)matchlen;
-    } else {
-      return 0;
-    }
-  } else if (matchlen < userlen) {
+  if (cpu_desc == NULL) {
     return 0;
   }
-
-  // We now know that the user string is shorter than
-  // the match string.
-
-  for (rv = 0; *user != '\0'; rv++) {
-    if (*user++ != *match++) {
-      return 0;
-    }
+  switch (t) {
+    case tr_reset:    return cpu_desc->tr_reset;
+    case tr_irq:      return cpu_desc->tr_irq;
+    case tr_firq:     return cpu_desc->tr_firq;
+    case tr_nmi:      return cpu_desc->tr_nmi;
+    default:          return 0;
   }
-  return rv;
 }
 
-//
-// Command parsing and execution
-//
-#define MAX_ARGS  8
-int argc;
-char *argv[MAX_ARGS];
-
-
-#define CMDBUF_LEN  64
-char cmdbuf[CMDBUF_LEN];
-char saved_cmdbuf[CMDBUF_LEN];
-
-const struct {
-  const char *cpustr;
-  cpu_t cputype;
-} cputab[] = {
-  "6502",     cpu_6502,
-  "65C02",    cpu_65c02,
-  "6800",     cpu_6800,
-  "6809",     cpu_6809,
-  "6809E",    cpu_6809e,
-  "Z80",      cpu_z80,
-  NULL,       cpu_none,
-};
-
-void
-help_cpu(void)
+const char *
+trigger_signal_name(trigger_t t)
 {
-  int i;
+  const struct cpu_signal *sig = cpu_signal_lookup(trigger_signal(t));
 
-  tla_printf("usage: cpu        - show current CPU type\n");
-  tla_printf("       cpu <type> - set CPU type\n");
-  for (i = 0; cputab[i].cpustr != NULL; i++) {
-    tla_printf("%s%s%s\n",
-        i == 0 ? "\n" : "",
-        i == 0 ? "<type> must be: "
-               : "                ",
-        cputab[i].cpustr);
-  }
+  return sig != NULL ? sig->name : "<unknown>";
 }
 
+// Classify every sample in the buffer, in the order in which they were
+// taken, and store the results in the bus cycle type array.  This is
+// done once after capture; everything that cares about the cycle type
+// (list, export, statistics, search) uses the stored codes.
 void
-command_cpu(void)
+classify_cycles(void)
 {
-  if (argc == 1) {
-    show_cpu();
-    return;
-  } else if (argc != 2) {
-    help_cpu();
+  bus_cycle_t (*classify)(int, uint32_t *);
+  uint32_t cstate = 0;
+
+  if (cpu_desc == NULL) {
     return;
   }
+  classify = cpu_desc->classify;
 
-  int i;
-  for (i = 0; cputab[i].cpustr != NULL; i++) {
-    if (strcasecmp(cputab[i].cpustr, argv[1]) == 0) {
-      set_cpu(cputab[i].cputype);
-      if (triggerMode != tr_none && triggerMode != tr_manual) {
-        triggerMode = tr_none;
-        tla_printf("WARNING: trigger mode reset\n");
-      }
-      return;
-    }
+  PERF_BEGIN(perf);
+
+  int first = (triggerPoint - pretrigger + samples) % samples;
+  int i = first;
+  do {
+    set_bus_cycle(i, (*classify)(i, &cstate));
+    i = (i + 1) % samples;
+  } while (i != first);
+
+  PERF_END(pf_classify, perf, samples);
+}
+
+const char *
+trigger_cycle_name(cycle_t c)
+{
+  switch (c) {
+    case tr_read:       return "read";
+    case tr_write:      return "write";
+    case tr_either:     return "read or write";
+    default:            return "<unknown>";
   }
-  tla_printf("Invalid CPU type: %s\n", argv[1]);
 }
 
+// The trigger settings as a match_spec.
 void
-help_samples(void)
+trigger_spec(struct match_spec *ms)
 {
-  tla_printf("usage: samples         - show current sample count\n");
-  tla_printf("       samples <count> - set sample count\n");
-  tla_printf("\n<count> must be between 1 and %d.\n", BUFFSIZE);
+  ms->mode = triggerMode;
+  ms->cycle = triggerCycle;
+  ms->space = triggerSpace;
+  ms->level = triggerLevel;
+  ms->address = triggerAddress;
+  ms->address_mask = triggerAddressMask;
+  ms->data = triggerData;
+  ms->data_mask = triggerDataMask;
 }
 
-void
-command_samples(void)
+// Format a value of the given number of hex digits in which only the
+// bits in mask matter.  Whole don't-care digits are shown as X (e.g.
+// "C0X0"); anything finer gets an explicit mask.  Returns a pointer to
+// the end of the string.
+char *
+describe_masked(char *cp, uint32_t value, uint32_t mask, int digits)
 {
-  if (argc == 1) {
-    show_samples();
-    return;
-  } else if (argc != 2) {
-    help_samples();
-    return;
-  }
+  uint32_t nibble;
+  bool nibbles = true;
+  int i;
 
-  int c;
-  c = (int) strtol(argv[1], NULL, 10);
-  if (c < 1 || c > BUFFSIZE) {
-    tla_printf("Invalid sample count.\n");
-    help_samples();
-    return;
+  for (i = digits - 1; i >= 0; i--) {
+    nibble = (mask >> (4 * i)) & 0xf;
+    if (nibble != 0 && nibble != 0xf) {
+      nibbles = false;
+    }
   }
-
-  samples = c;
-  if (pretrigger > c) {
-    pretrigger = 0;
-    tla_printf("WARNING: pretrigger sample count reset to 0.\n");
+  if (!nibbles) {
+    return cp + sprintf(cp, "%0*lX mask %0*lX", digits, value & mask, digits, mask);
   }
-  memset(control, 0, sizeof(control)); // Clear existing data
-  memset(address, 0, sizeof(address));
-  memset(data, 0, sizeof(data));
+  for (i = digits - 1; i >= 0; i--) {
+    if (((mask >> (4 * i)) & 0xf) == 0) {
+      *cp++ = 'X';
+    } else {
+      cp += sprintf(cp, "%lX", (value >> (4 * i)) & 0xf);
+    }
+  }
+  *cp = '\0';
+  return cp;
 }
 
-void
-help_pretrigger(void)
+// Describe a match condition, e.g. "on address C012 write".  Returns
+// a pointer to the end of the string.
+char *
+describe_match(char *cp, const struct match_spec *ms)
 {
-  tla_printf("usage: pretrigger         - show current pretrigger sample count\n");
-  tla_printf("       pretrigger <count> - set pretrigger sample count\n");
-  tla_printf("\n<count> must be between 0 and the numnber of samples (currently %d).\n",
-      samples);
-  tla_printf("\nType \"help samples\" for more information.\n");
+  switch (ms->mode) {
+    case tr_address:
+    case tr_data:
+    case tr_addr_data:
+      cp += sprintf(cp, "on%s %s ",
+          ms->space == tr_io ? " io" : "",
+          ms->mode == tr_data ? "data" : "address");
+      if (ms->mode != tr_data) {
+        cp = describe_masked(cp, ms->address, ms->address_mask,
+            ms->space == tr_io ? 2 : 4);
+      } else {
+        cp = describe_masked(cp, ms->data, ms->data_mask, 2);
+      }
+      if (ms->mode == tr_addr_data) {
+        cp += sprintf(cp, " and data ");
+        cp = describe_masked(cp, ms->data, ms->data_mask, 2);
+      }
+      cp += sprintf(cp, " %s", trigger_cycle_name(ms->cycle));
+      break;
+
+    case tr_reset:
+    case tr_irq:
+    case tr_firq:
+    case tr_nmi:
+      cp += sprintf(cp, "on %s %s", trigger_signal_name(ms->mode),
+          ms->level ? "high" : "low");
+      break;
+
+    case tr_change:
+      cp += sprintf(cp, "on write to address ");
+      cp = describe_masked(cp, ms->address, ms->address_mask, 4);
+      if (ms->data_mask == 0) {
+        cp += sprintf(cp, " that changes its value");
+      } else {
+        cp += sprintf(cp, " of other than ");
+        cp = describe_masked(cp, ms->data, ms->data_mask, 2);
+      }
+      break;
+
+    case tr_illegal:
+      cp += sprintf(cp, "illegal opcode fetch");
+      break;
+
+    case tr_manual:
+      cp += sprintf(cp, "manual (button)");
+      break;
+
+    case tr_none:
+      cp += sprintf(cp, "none (immediate)");
+      break;
+  }
+  return cp;
 }
 
 void
-command_pretrigger(void)
+show_trigger(void)
 {
-  if (argc == 1) {
-    show_pretrigger();
-    return;
-  } else if (argc != 2) {
-    help_pretrigger();
-    return;
-  }
+  char msg[80 * TRIG_STAGES], *cp = msg;
 
-  int c;
-  c = (int) strtol(argv[1], NULL, 10);
-  if (c < 0 || c > samples) {
-    tla_printf("Invalid pretrigger samples count.\n");
-    help_pretrigger();
-    return;
+  cp += sprintf(cp, "Trigger: ");
+  describe_trigger(cp);
+  tla_printf("%s\n", msg);
+  if (triggerOut != to_off) {
+    tla_printf("Trigger out: pin %d, active %s\n", TRIGGER_OUT_PIN,
+        triggerOut == to_high ? "high" : "low");
   }
+}
 
-  if (triggerMode == tr_none) {
-    tla_printf("Cannot have pretrigger samples with trigger mode 'none'.\n");
-    pretrigger = 0;
-    return;
+// Report how long trigger out took to follow the bus after the last
+// capture (not counting the time to see and match the bus cycle).
+void
+show_trigger_out_latency(void)
+{
+  if (triggerOut != to_off) {
+    tla_printf("Trigger out latency: at least %lu cycles (%lu ns)\n", triggerOutLatency,
+        triggerOutLatency * 1000 / (F_CPU_ACTUAL / 1000000));
   }
+}
 
-  pretrigger = c;
+void
+show_samples(void)
+{
+  tla_printf("Sample buffer size: %d\n", samples);
 }
 
-const struct {
-  const char *typestr;
-  trigger_t   type;
-  uint32_t    forcpus;
-  uint32_t    notcpus;
-} triggertab[] = {
-  { "address",  tr_address },
-  { "data",     tr_data },
-  { "reset",    tr_reset },
-  { "irq",      tr_irq,
-                0,
-                (1U << cpu_z80) },
-  { "int",      tr_irq,
-                (1U << cpu_z80),
-                0 },
-  { "firq",     tr_firq,
-                (1U << cpu_6809) | (1U << cpu_6809e),
-                0 },
-  { "nmi",      tr_nmi },
-  { "manual",   tr_manual },
-  { "none",     tr_none },
-  { NULL },
-};
+void
+show_pretrigger(void)
+{
+  tla_printf("Pretrigger samples: %d\n", pretrigger);
+}
 
 void
-help_trigger(void)
+disassemble_one(uint32_t where)
 {
-  tla_printf("usage: trigger %s                                  - show current trigger\n",
-      cpu_has_iospace(cpu) ? "     " : "");
-  tla_printf("       trigger %saddress <addr> [r|w]              - trigger on address\n",
-      cpu_has_iospace(cpu) ? "[io] " : "");
-  tla_printf("       trigger %sdata <value> [r|w]                - trigger on data\n",
-      cpu_has_iospace(cpu) ? "[io] " : "");
-  tla_printf("       trigger %saddress <addr> data <value> [r|w] - trigger on address and data\n",
-      cpu_has_iospace(cpu) ? "[io] " : "");
-  tla_printf("\n       trigger reset 0|1%s                         - trigger on /RESET level\n",
-      cpu_has_iospace(cpu) ? "     " : "");
-  if (cpu == cpu_z80) {
-    tla_printf("       trigger int 0|1%s                           - trigger on /INT level\n",
-        cpu_has_iospace(cpu) ? "     " : "");
-  } else if (cpu != cpu_none) {
-    tla_printf("       trigger irq 0|1%s                           - trigger on /IRQ level\n",
-        cpu_has_iospace(cpu) ? "     " : "");
-  }
-  if (cpu == cpu_6809 || cpu == cpu_6809e) {
-    tla_printf("       trigger firq 0|1%s                          - trigger on /FIRQ level\n",
-        cpu_has_iospace(cpu) ? "     " : "");
-  }
-  tla_printf("       trigger nmi 0|1%s                           - trigger on /NMI level\n",
-      cpu_has_iospace(cpu) ? "     " : "");
+  struct insn_decode id;
 
-  if (cpu_has_iospace(cpu)) {
-    tla_printf("\n<addr> must be between 0 and FF for I/O space and 0 and FFFF for memory space.\n");
-  } else {
-    tla_printf("\n<addr> must be between 0 and FFFF.\n");
+  if (cpu_desc == NULL) {
+    tla_printf("No CPU type selected!\n");
+    return;
+  }
+  insn_decode_init(&id, cpu_desc->decode);
+
+  int first = (triggerPoint - pretrigger + samples) % samples;
+  int last = (triggerPoint - pretrigger + samples - 1) % samples;
+  int i;
+  uint8_t op;
+
+  // First, search through the sample data looking for the address.
+  for (i = first; i != last; i = (i + 1) % samples) {
+    if (address[i] == where) {
+      break;
+    }
+  }
+  if (address[i] != where) {
+    if (mem_image_byte(where, &op)) {
+      tla_printf("%04lX  %02X  %s\n", where, op, mem_image_decode(&id, where, op));
+      return;
+    }
+    tla_printf("Address not found in sample data or memory image.\n");
+    return;
+  }
+
+  for (;; i = (i + 1) % samples) {
+    switch (id.state) {
+      case ds_idle:
+        insn_decode_begin(&id, address[i], data[i]);
+        goto printit;
+
+      case ds_fetching:
+        if (address[i] != where + id.bytes_fetched) {
+          tla_printf("!!!! Non-contiguous instruction fetch?\n");
+        }
+        // FALLTHROUGH
+
+      default:
+        insn_decode_continue(&id, data[i]);
+      printit:
+        tla_printf("%04lX  %02lX  %s\n",
+            address[i], data[i], insn_decode_complete(&id));
+        break;
+    }
+    if (id.state == ds_complete || i == last) {
+      return;
+    }
   }
-  tla_printf("<data> must be between 0 and FF.\n");
 }
 
+// Paged listing state.  Page positions are sample numbers counted from
+// the oldest sample in the buffer, the same numbering "list <start> <end>"
+// uses.  listDecode holds the decoder state for the sample after listEnd,
+// so paging forward picks up a partially-listed instruction where the
+// previous page left off.
+#define LIST_PAGE_LINES     20
+#define LIST_DECODE_REPLAY  16    // how far back to look for an opcode fetch
+int listStart = -1;                   // First sample on the current page
+int listEnd = -1;                     // Last sample on the current page
+int listMark = -1;                    // Last "goto" target
+struct insn_decode listDecode;
+
+// Forget the listing position; called whenever the sample buffer or
+// its interpretation changes.
 void
-command_trigger(void)
+list_reset(void)
 {
-  if (argc == 1) {
-    show_trigger();
-    return;
+  listStart = listEnd = listMark = -1;
+}
+
+// Returns true (and consumes it) if the user has typed Ctrl-C.  Anything
+// else is left in the input queue for the command line.
+bool
+userInterrupt(void)
+{
+  if (Serial.available() > 0 && Serial.peek() == 0x03) {
+    Serial.read();
+    return true;
   }
+  return false;
+}
 
-  int i, argidx = 1, modeidx;
-  uint32_t cpumask;
-  bool iomodifier = false;
+// Feed sample i to the instruction decoder.  Returns true if the sample
+// was consumed as an operand byte.
+static bool
+list_decode_sample(struct insn_decode *id, int i)
+{
+  switch (bus_cycle(i)) {
+    case bc_fetch:
+      insn_decode_begin(id, address[i], data[i]);
+      break;
 
-  cpumask = (cpu == cpu_none) ? 0 : (1U << cpu);
+    case bc_read:
+      return insn_decode_continue(id, data[i]);
 
-  // First, the trigger type.
- mode_again:
-  for (modeidx = -1, i = 0; triggertab[i].typestr != NULL; i++) {
-    // Special case for CPUs with I/O space -- check for "io" modifier.
-    if (cpu_has_iospace(cpu) && strcmp(argv[argidx], "io") == 0) {
-      if (iomodifier) {
-        help_trigger();
-        return;
-      }
-      iomodifier = true;
-      argidx++;
-      goto mode_again;
+    default:
+      break;
+  }
+  return false;
+}
+
+// The listing starts at sample number start, in the middle of an
+// instruction whose opcode wasn't captured.  If the memory image has an
+// instruction that the following reads continue, start the decoder on it
+// so that the rest of its bytes decode.
+static void
+list_decode_from_image(struct insn_decode *id, int start)
+{
+  int first = (triggerPoint - pretrigger + samples) % samples;
+  int i = (first + start) % samples, k, n;
+  uint32_t addr = address[i], pc;
+  uint8_t op, b = 0;
+
+  if (bus_cycle(i) != bc_read) {
+    return;
+  }
+  for (k = 1; k < INSN_DECODE_MAXBYTES; k++) {
+    pc = (addr - k) & 0xffff;
+    if (!mem_image_byte(pc, &op)) {
+      break;
     }
-    if (triggertab[i].forcpus != 0 || triggertab[i].notcpus != 0) {
-      // If there's a CPU filter, we need to have the CPU type set.
-      if (cpumask == 0) {
-        continue;
-      }
-      if (triggertab[i].notcpus != 0 &&
-          (triggertab[i].notcpus & cpumask) != 0) {
-        continue;
-      }
-      if (triggertab[i].forcpus != 0 &&
-          (triggertab[i].forcpus & cpumask) == 0) {
-        continue;
-      }
+    mem_image_decode(id, pc, op);
+    if (id->state != ds_complete || id->bytes_fetched <= k) {
+      continue;
     }
-    if (stringMatch(triggertab[i].typestr, argv[argidx]) > 0) {
-      if (modeidx != -1) {
-        tla_printf("Ambiguous trigger mode.");
-        help_trigger();
-        return;
+    // The rest of the instruction has to be in the samples.
+    for (n = k; n < id->bytes_fetched && start + n - k < samples; n++) {
+      i = (first + start + n - k) % samples;
+      if (bus_cycle(i) != bc_read || address[i] != ((pc + n) & 0xffff) ||
+          data[i] != id->bytes[n]) {
+        break;
       }
-      modeidx = i;
     }
+    if (n < id->bytes_fetched) {
+      continue;
+    }
+    insn_decode_init(id, cpu_desc->decode);
+    insn_decode_begin(id, pc, op);
+    for (n = 1; n < k; n++) {
+      mem_image_byte(pc + n, &b);
+      insn_decode_continue(id, b);
+    }
+    return;
   }
+  insn_decode_init(id, cpu_desc->decode);
+}
 
-  trigger_t new_triggerMode;
-  if (modeidx == -1) {
-    // If we got the iomodifier, allow it as an alias for "address".
-    if (iomodifier) {
-      new_triggerMode = tr_address;
-      // Walk back the argument cursor to point at "io".
-      argidx--;
-    } else {
-      tla_printf("Invalid trigger mode.\n");
-      help_trigger();
-      return;
+// Set up the decoder for a listing that starts at sample number start.
+// If start falls in the middle of an instruction, replay that instruction's
+// bytes (without listing them) so its remaining lines decode properly.
+void
+list_decode_seek(struct insn_decode *id, int start)
+{
+  int first = (triggerPoint - pretrigger + samples) % samples;
+  int j;
+
+  insn_decode_init(id, cpu_desc->decode);
+  for (j = start; j > 0 && start - j < LIST_DECODE_REPLAY; j--) {
+    if (bus_cycle((first + j) % samples) == bc_fetch) {
+      break;
     }
-  } else {
-    new_triggerMode = triggertab[modeidx].type;
   }
+  if (bus_cycle((first + j) % samples) != bc_fetch) {
+    list_decode_from_image(id, start);
+    return;
+  }
+  for (; j < start; j++) {
+    list_decode_sample(id, (first + j) % samples);
+  }
+}
 
-  cycle_t new_triggerCycle = triggerCycle;
-  space_t new_triggerSpace = triggerSpace;
-  bool new_triggerLevel = triggerLevel;
-  uint32_t new_triggerAddress = triggerAddress;
-  uint32_t new_triggerData = triggerData;
+// List recorded data from start to end.  If id is NULL a private decoder
+// is used; otherwise id must already be positioned at start (see
+// list_decode_seek()) and is left positioned after the last line listed.
+// Returns the number of the last sample listed, which is less than end
+// if the user interrupted the listing.
+int
+list(Stream &stream, int start, int end, int validSamples, struct insn_decode *id)
+{
+  char comment[40], *cp, delta[12];
+  char output[49 + sizeof(comment)];
+  uint8_t ib;
 
-  argidx++;
+  if (cpu == cpu_none || validSamples == 0) {
+    return start - 1;
+  }
 
-  if (iomodifier && (new_triggerMode != tr_address &&
-                     new_triggerMode != tr_data)) {
-    tla_printf("Invalid trigger mode for \"io\" modifier.\n");
-    help_trigger();
-    return;
+  int first = (triggerPoint - pretrigger + samples) % samples;
+
+  const struct cpu_signal *sig;
+  const struct cpu_region *reg;
+  bus_cycle_t bc;
+
+  const char *cycle, *trig;
+  const char *comma;
+
+  PERF_BEGIN(perf);
+
+  struct insn_decode pid;
+  if (id == NULL) {
+    id = &pid;
+    list_decode_seek(id, start);
   }
 
-  switch (new_triggerMode) {
-    case tr_none:
-      if (pretrigger != 0) {
-        tla_printf("Warning: pretrigger reset to 0.\n");
-        pretrigger = 0;
+  // Display data
+  int i, j;
+  for (j = start; j <= end; j++) {
+    if (userInterrupt()) {
+      tla_printf("^C\n");
+      break;
+    }
+    i = (first + j) % samples;
+
+    trig = "";
+    comma = "";
+    comment[0] = '\0';
+    cp = comment;
+
+    bc = bus_cycle(i);
+    cycle = bus_cycle_name(bc);
+    if (list_decode_sample(id, i)) {
+      cycle = "*";
+    }
+
+    // Comments that don't fit are cut short rather than overflowing.
+#define COMMENT(str) do { \
+      cp += snprintf(cp, comment + sizeof(comment) - cp, "%s%s", comma, str); \
+      if (cp > comment + sizeof(comment) - 1) { \
+        cp = comment + sizeof(comment) - 1; \
+      } \
+      comma = ","; \
+    } while (0)
+
+    // Check for asserted interrupt / reset signals.
+    for (sig = cpu_desc->signals; sig->name != NULL; sig++) {
+      if (sig->comment != NULL && cpu_signal_asserted(sig, control[i])) {
+        COMMENT(sig->comment);
       }
-      // FALLTHROUGH
-    case tr_manual:
-      if (argidx != argc) {
-        help_trigger();
-        return;
+    }
+
+    // Check for vector address or stack access.
+    for (reg = cpu_desc->regions; reg->name != NULL; reg++) {
+      if (address[i] >= reg->first && address[i] <= reg->last) {
+        COMMENT(reg->name);
+        break;
       }
-      break;
+    }
 
-    case tr_address:
-    case tr_data: {
-      //
-      // We accept lines like this:
-      //
-      //  t io addr 0x42 data 0xff
-      //  t data $a5 address $cafe w
-      //  t a FFFFh r
+    // Check reads against the memory image.
+    if ((bc == bc_fetch || bc == bc_read || bc == bc_vector) &&
+        mem_image_byte(address[i], &ib) && ib != data[i]) {
+      COMMENT("MISMATCH");
+    }
+
+    // Write log records show when they happened.
+    if (captureMode == cm_writes) {
+      snprintf(delta, sizeof(delta), "+%lu", recordInfo[i]);
+      COMMENT(delta);
+    }
+
+    // Compressed records show how many times they repeated.
+    if (captureMode == cm_compressed && recordInfo[i] != 0) {
+      snprintf(delta, sizeof(delta), "x%lu", recordInfo[i] + 1);
+      COMMENT(delta);
+    }
+
+#undef COMMENT
+
+    // Indicate when trigger happened
+    if (i == triggerPoint) {
+      trig = "<--";
+    }
+
+    // This printf format needs to be kept in sync with INSN_DECODE_MAXSTRING.
+    snprintf(output, sizeof(output),
+        "%04lX  %-2s  %02lX  %-28s  %-3s  %s",
+        address[i], cycle, data[i], insn_decode_complete(id),
+        trig, comment);
+
+    stream.println(output);
+  }
+
+  PERF_END(pf_list, perf, j - start);
+  return j - 1;
+}
+
+// List samples start through end on the console and make that the
+// current page.
+void
+list_show(int start, int end)
+{
+  if (cpu == cpu_none || samplesTaken == 0) {
+    tla_printf("No samples to list.\n");
+    return;
+  }
+  if (listEnd < 0 || start != listEnd + 1) {
+    list_decode_seek(&listDecode, start);
+  }
+  listStart = start;
+  listEnd = list(Serial, start, end, samplesTaken, &listDecode);
+}
+
+// Show a page of samples beginning at sample number start.
+void
+list_page(int start)
+{
+  if (start > samples - LIST_PAGE_LINES) {
+    start = samples - LIST_PAGE_LINES;
+  }
+  if (start < 0) {
+    start = 0;
+  }
+  int end = start + LIST_PAGE_LINES - 1;
+  if (end >= samples) {
+    end = samples - 1;
+  }
+  list_show(start, end);
+}
+
+// Show a page with sample number j in the middle.
+void
+list_page_around(int j)
+{
+  list_page(j - LIST_PAGE_LINES / 2);
+}
+
+// Sample number of the trigger point.
+int
+list_trigger_sample(void)
+{
+  int first = (triggerPoint - pretrigger + samples) % samples;
+
+  return (triggerPoint - first + samples) % samples;
+}
+
+const struct {
+  const char    *name;
+  export_col_t  type;
+} export_fields[] = {
+  { "Index",        ec_index },
+  { "Trigger",      ec_trigger },
+  { "Address",      ec_address },
+  { "Data",         ec_data },
+  { "Cycle",        ec_cycle },
+  { "Instruction",  ec_insn },
+  { "Repeat",       ec_repeat },
+  { NULL },
+};
+
+const char *
+export_column_name(const struct export_column *col)
+{
+  int i;
+
+  if (col->type == ec_signal) {
+    return col->sig->name;
+  }
+  for (i = 0; export_fields[i].name != NULL; i++) {
+    if (export_fields[i].type == col->type) {
+      return export_fields[i].name;
+    }
+  }
+  return "?";
+}
+
+// Fill in the CPU's default column set; returns the number of columns.
+int
+export_default_columns(struct export_column *cols)
+{
+  const struct cpu_signal *sig;
+  int n = 0;
+
+  cols[n++].type = ec_index;
+  cols[n++].type = ec_trigger;
+  for (sig = cpu_desc->signals; sig->name != NULL; sig++) {
+    if (sig->csv) {
+      cols[n].type = ec_signal;
+      cols[n++].sig = sig;
+    }
+  }
+  cols[n++].type = ec_address;
+  cols[n++].type = ec_data;
+  if (captureMode == cm_compressed) {
+    cols[n++].type = ec_repeat;
+  }
+  return n;
+}
+
+// Show the recorded data in CSV format (e.g. to export to spreadsheet or other program).
+// Only the selected columns are computed; the instruction decoder is
+// only run if the decoded instruction column is selected.
+void
+exportCSV(Stream &stream, int validSamples)
+{
+  struct export_column defcols[MAX_EXPORT_COLUMNS];
+  const struct export_column *cols = exportColumns;
+  int ncols = exportColumnCount;
+  bool want_insn = false;
+  char output[MAX_EXPORT_COLUMNS * EXPORT_COLUMN_WIDTH + 1], *cp;
+  int c;
+
+  if (cpu == cpu_none || validSamples == 0) {
+      return;
+  }
+
+  PERF_BEGIN(perf);
+
+  if (ncols == 0) {
+    ncols = export_default_columns(defcols);
+    cols = defcols;
+  }
+
+  // Output header
+  cp = output;
+  for (c = 0; c < ncols; c++) {
+    cp += sprintf(cp, "%s%s", c ? "," : "", export_column_name(&cols[c]));
+    if (cols[c].type == ec_insn) {
+      want_insn = true;
+    }
+  }
+  *cp = '\0';
+  stream.println(output);
+
+  struct insn_decode id;
+  insn_decode_init(&id, want_insn ? cpu_desc->decode : NULL);
+
+  int first = (triggerPoint - pretrigger + samples) % samples;
+  int last = (triggerPoint - pretrigger + samples - 1) % samples;
+
+  // Display data
+  int i = first;
+  int j = 0;
+  while (true) {
+    if (want_insn) {
+      if (bus_cycle(i) == bc_fetch) {
+        insn_decode_begin(&id, address[i], data[i]);
+      } else if (bus_cycle(i) == bc_read) {
+        insn_decode_continue(&id, data[i]);
+      }
+    }
+
+    cp = output;
+    for (c = 0; c < ncols; c++) {
+      if (c) {
+        *cp++ = ',';
+      }
+      switch (cols[c].type) {
+        case ec_index:
+          cp += sprintf(cp, "%d", j);
+          break;
+
+        case ec_trigger:
+          *cp++ = i == triggerPoint ? '1' : '0';
+          break;
+
+        case ec_signal:
+          *cp++ = (control[i] & cols[c].sig->mask) ? '1' : '0';
+          break;
+
+        case ec_address:
+          cp += sprintf(cp, "%04lX", address[i]);
+          break;
+
+        case ec_data:
+          cp += sprintf(cp, "%02lX", data[i]);
+          break;
+
+        case ec_cycle:
+          cp += sprintf(cp, "%s", bus_cycle_name(bus_cycle(i)));
+          break;
+
+        case ec_insn:
+          // Operands can contain commas.
+          cp += sprintf(cp, "\"%s\"", insn_decode_complete(&id));
+          break;
+
+        case ec_repeat:
+          cp += sprintf(cp, "%lu",
+              captureMode == cm_compressed ? recordInfo[i] + 1 : 1);
+          break;
+      }
+    }
+    *cp = '\0';
+    stream.println(output);
+
+    if (i == last) {
+      break;
+    }
+
+    i = (i + 1) % samples;
+    j++;
+  }
+
+  PERF_END(pf_export, perf, j + 1);
+}
+
+// Write the recorded data to files on the internal SD card slot.
+void
+writeSD(void)
+{
+  const char *CSV_FILE = "analyzer.csv";
+  const char *TXT_FILE = "analyzer.txt";
+  uint32_t bytes = 0;
+
+  if (cpu == cpu_none || samplesTaken == 0) {
+    tla_printf("No samples to save.\n");
+    return;
+  }
+
+  if (!SD.begin(BUILTIN_SDCARD)) {
+    tla_printf("Unable to initialize internal SD card.\n");
+    return;
+  }
+
+  PERF_BEGIN(perf);
+
+  // Remove any existing file
+  if (SD.exists(CSV_FILE)) {
+    SD.remove(CSV_FILE);
+  }
+
+  File file = SD.open(CSV_FILE, FILE_WRITE);
+  if (file) {
+    tla_printf("Writing %s\n", CSV_FILE);
+    exportCSV(file, samplesTaken);
+    bytes += file.size();
+    file.close();
+  } else {
+    tla_printf("Unable to write %s\n", CSV_FILE);
+  }
+
+  // Remove any existing file
+  if (SD.exists(TXT_FILE)) {
+    SD.remove(TXT_FILE);
+  }
+
+  file = SD.open(TXT_FILE, FILE_WRITE);
+  if (file) {
+    tla_printf("Writing %s\n", TXT_FILE);
+    list(file, 0, samples - 1, samplesTaken, NULL);
+    bytes += file.size();
+    file.close();
+  } else {
+    tla_printf("Unable to write %s\n", TXT_FILE);
+  }
+
+  PERF_END(pf_write_sd, perf, bytes);
+}
+
+
+// Encode a match condition into the GPIO bit patterns that the capture
+// loops compare against.
+void
+encode_match(const struct match_spec *ms, struct bus_match *bm)
+{
+  uint32_t which_c_trigger = 0;
+
+  memset(bm, 0, sizeof(*bm));
+
+  // Scramble the trigger address, control, and data lines to match what we will read on the ports.
+
+  if (ms->mode == tr_address || ms->mode == tr_data || ms->mode == tr_addr_data ||
+      ms->mode == tr_change) {
+    uint32_t tmask = 0, tbits = 0;
+
+    // Don't-care bits are left out of the masks, so they cost nothing
+    // in the capture loops.  tr_change only matches the address here;
+    // the data is checked by trig_changed().
+    if (ms->mode == tr_address || ms->mode == tr_addr_data || ms->mode == tr_change) {
+      bm->a_bits = scramble_CAxx(ms->address);
+      if (ms->space == tr_io) {
+        bm->a_mask = scramble_CAxx(ms->address_mask & 0xff);
+      } else {
+        bm->a_mask = scramble_CAxx(ms->address_mask & 0xffff);
+      }
+    }
+    if (ms->mode == tr_data || ms->mode == tr_addr_data) {
+      bm->d_bits = scramble_CDxx(ms->data);
+      bm->d_mask = scramble_CDxx(ms->data_mask & 0xff);
+    }
+
+    // Check for memory / I/O space qualifier
+    if (cpu_desc->space_mask != 0) {
+      tmask |= cpu_desc->space_mask;
+      tbits |= ms->space == tr_io ? cpu_desc->io_bits : cpu_desc->mem_bits;
+    }
+
+    // Check for r/w qualifer
+    if (ms->cycle == tr_read) {
+      tmask |= cpu_desc->rw_mask;
+      tbits |= cpu_desc->read_bits;
+    } else if (ms->cycle == tr_write) {
+      tmask |= cpu_desc->rw_mask;
+      tbits |= cpu_desc->write_bits;
+    }
+
+    bm->c_mask = scramble_CCxx(tmask, &bm->a_mask, &bm->d_mask);
+    bm->c_bits = scramble_CCxx(tbits, &bm->a_bits, &bm->d_bits);
+  } else {
+    which_c_trigger = trigger_signal(ms->mode);
+  }
+  // TODO: Add support other Z80 control line triggers.
+
+  // If a control signal trigger was specified, encode it.
+  if (which_c_trigger) {
+    bm->c_mask = scramble_CCxx(which_c_trigger, &bm->a_mask, &bm->d_mask);
+    if (ms->level) {
+      bm->c_bits = scramble_CCxx(which_c_trigger, &bm->a_bits, &bm->d_bits);
+    }
+  }
+
+  bm->a_bits &= bm->a_mask;
+  bm->c_bits &= bm->c_mask;
+  bm->d_bits &= bm->d_mask;
+}
+
+// Encode a control signal pattern (logical CC_xxx_yyy bits).
+void
+encode_signals(uint32_t mask, uint32_t bits, struct bus_match *bm)
+{
+  memset(bm, 0, sizeof(*bm));
+  bm->c_mask = scramble_CCxx(mask, &bm->a_mask, &bm->d_mask);
+  bm->c_bits = scramble_CCxx(bits, &bm->a_bits, &bm->d_bits);
+}
+
+// Describe the trigger stages, e.g. "on address 1000 read or write,
+// 3 times, then on data 55 write".
+void
+describe_trigger(char *cp)
+{
+  struct match_spec ms;
+  uint32_t count = triggerCount;
+  int s;
+
+  trigger_spec(&ms);
+  for (s = 0; ; s++) {
+    cp = describe_match(cp, &ms);
+    if (count > 1) {
+      cp += sprintf(cp, ", %lu times", count);
+    }
+    if (s == triggerThenCount) {
+      break;
+    }
+    ms = triggerThen[s].spec;
+    count = triggerThen[s].count;
+    cp += sprintf(cp, ", then ");
+  }
+}
+
+static void
+trig_emit(trig_op_t op, int arg, uint32_t imm)
+{
+  struct trig_insn *ti = &trigProgram[trigLength++];
+
+  ti->op = op;
+  ti->arg = arg;
+  ti->imm = imm;
+}
+
+// Compile the trigger stages into trigProgram.  Each stage is laid out
+// after the one before, so its size says where the next one starts:
+//
+//      match   m           ; tr_none is just "fire" (or "goto next"),
+//      skip    4           ; and tr_manual is "end", since only the
+//      inc     r           ; button triggers it
+//      ge      r, count    ; (no inc/ge/skip if count is 1)
+//      skip    1
+//      goto    next        ; or "fire" in the last stage
+//      end
+void
+trig_compile(void)
+{
+  struct match_spec ms;
+  uint32_t count = triggerCount;
+  int s, next;
+  bool last;
+
+  trigLength = 0;
+  trigMatchCount = 0;
+  trigTrackFetch = false;
+  encode_signals(cpu_desc->fetch_mask, cpu_desc->fetch_bits, &trigFetch);
+  trigFetchFollows = cpu_desc->fetch_follows;
+  trigger_spec(&ms);
+  for (s = 0; s <= triggerThenCount; s++) {
+    if (s != 0) {
+      ms = triggerThen[s - 1].spec;
+      count = triggerThen[s - 1].count;
+    }
+    last = s == triggerThenCount;
+
+    if (ms.mode == tr_none) {
+      trig_emit(last ? tp_fire : tp_goto, trigLength + 1, 0);
+      continue;
+    }
+    if (ms.mode == tr_manual) {
+      trig_emit(tp_end, 0, 0);
+      continue;
+    }
+
+    next = trigLength + (count > 1 ? 7 : 4);
+    if (ms.mode == tr_illegal) {
+      trig_emit(tp_illegal, 0, 0);
+      trigTrackFetch = true;
+    } else {
+      encode_match(&ms, &trigMatches[trigMatchCount]);
+      if (ms.mode == tr_change) {
+        trig_emit(tp_change, trigMatchCount++,
+            ms.data_mask == 0 ? 0 : (ms.data_mask << 8) | ms.data);
+      } else {
+        trig_emit(tp_match, trigMatchCount++, 0);
+      }
+    }
+    trig_emit(tp_skip_unless, count > 1 ? 4 : 1, 0);
+    if (count > 1) {
+      trig_emit(tp_inc, s, 0);
+      trig_emit(tp_ge, s, count);
+      trig_emit(tp_skip_unless, 1, 0);
+    }
+    trig_emit(last ? tp_fire : tp_goto, next, 0);
+    trig_emit(tp_end, 0, 0);
+  }
+
+  // A tr_none match is all don't-cares; a tr_manual one can never match.
+  trigger_spec(&ms);
+  trigFast = triggerThenCount == 0 && triggerCount == 1 &&
+      ms.mode != tr_change && ms.mode != tr_illegal;
+  memset(&trigFastMatch, 0, sizeof(trigFastMatch));
+  if (ms.mode == tr_manual) {
+    trigFastMatch.a_bits = ~0U;
+  } else if (ms.mode != tr_none) {
+    trigFastMatch = trigMatches[0];
+  }
+}
+
+// Check that trigProgram is well formed: every argument is in range,
+// every branch goes forward and no instruction runs off the end.  Sets
+// *worstp to the most instructions any bus cycle can run.  Returns
+// false, with a message, if the program is invalid or could run more
+// than TRIG_MAX_STEPS instructions in a bus cycle.
+bool
+trig_check(int *worstp)
+{
+  uint8_t steps[TRIG_MAX_INSNS];
+  bool entry[TRIG_MAX_INSNS];
+  const struct trig_insn *ti;
+  int pc, next, worst = 0;
+
+  if (trigLength == 0) {
+    tla_printf("Trigger program is empty.\n");
+    return false;
+  }
+  memset(entry, 0, sizeof(entry));
+  entry[0] = true;
+
+  // Work backwards, so steps[] is known for everything after pc.
+  for (pc = trigLength - 1; pc >= 0; pc--) {
+    ti = &trigProgram[pc];
+    next = pc + 1;
+    switch (ti->op) {
+      case tp_end:
+      case tp_fire:
+        steps[pc] = 1;
+        continue;
+
+      case tp_goto:
+        if (ti->arg >= trigLength) {
+          goto bad;
+        }
+        entry[ti->arg] = true;
+        steps[pc] = 1;
+        continue;
+
+      case tp_skip_unless:
+        if (next + ti->arg >= trigLength) {
+          goto bad;
+        }
+        steps[pc] = 1 + (steps[next] > steps[next + ti->arg] ?
+            steps[next] : steps[next + ti->arg]);
+        continue;
+
+      case tp_match:
+      case tp_change:
+        if (ti->arg >= trigMatchCount) {
+          goto bad;
+        }
+        break;
+
+      case tp_inc:
+      case tp_ge:
+        if (ti->arg >= TRIG_REGS) {
+          goto bad;
+        }
+        break;
+
+      case tp_illegal:
+        break;
+
+      default:
+        goto bad;
+    }
+    if (next >= trigLength) {
+      goto bad;
+    }
+    steps[pc] = 1 + steps[next];
+  }
+
+  for (pc = 0; pc < trigLength; pc++) {
+    if (entry[pc] && steps[pc] > worst) {
+      worst = steps[pc];
+    }
+  }
+  *worstp = worst;
+  if (worst > TRIG_MAX_STEPS) {
+    tla_printf("Trigger program can take %d steps per bus cycle; the limit is %d.\n",
+        worst, TRIG_MAX_STEPS);
+    return false;
+  }
+  return true;
+
+ bad:
+  tla_printf("Trigger program is invalid at instruction %d.\n", pc);
+  return false;
+}
+
+// List the compiled trigger program.
+void
+trig_list(void)
+{
+  static const char * const opnames[] = {
+    "match", "skip", "inc", "ge", "end", "goto", "fire", "change", "illegal",
+  };
+  const struct trig_insn *ti;
+  int pc, worst;
+  bool ok;
+
+  if (cpu_desc == NULL) {
+    tla_printf("No CPU type selected!\n");
+    return;
+  }
+  trig_compile();
+  ok = trig_check(&worst);
+  for (pc = 0; pc < trigLength; pc++) {
+    ti = &trigProgram[pc];
+    tla_printf("%3d  %-7s", pc, opnames[ti->op]);
+    switch (ti->op) {
+      case tp_match:
+      case tp_goto:
+        tla_printf("%d", ti->arg);
+        break;
+      case tp_skip_unless:
+        tla_printf("%d unless matched", ti->arg);
+        break;
+      case tp_inc:
+        tla_printf("r%d", ti->arg);
+        break;
+      case tp_ge:
+        tla_printf("r%d, %lu", ti->arg, ti->imm);
+        break;
+      case tp_change:
+        if (ti->imm == 0) {
+          tla_printf("%d", ti->arg);
+        } else {
+          tla_printf("%d, data %02lX mask %02lX", ti->arg, ti->imm & 0xff, ti->imm >> 8);
+        }
+        break;
+    }
+    tla_printf("\n");
+  }
+  if (ok) {
+    tla_printf("At most %d steps per bus cycle (limit %d).\n", worst, TRIG_MAX_STEPS);
+  }
+  if (trigFast) {
+    tla_printf("Single stage: the capture loop matches it without the program.\n");
+  }
+}
+
+// Run the trigger program over the recorded samples, as the capture
+// kernels would have, and show where it fires.
+void
+trig_test(void)
+{
+  int first = (triggerPoint - pretrigger + samples) % samples;
+  uint32_t a, c, d;
+  int i, j;
+
+  if (cpu == cpu_none || samplesTaken == 0 || captureMode != cm_samples) {
+    tla_printf("No samples to test against.\n");
+    return;
+  }
+  if (!setup_triggers()) {
+    return;
+  }
+  trig_reset();
+  for (j = 0; j < samples; j++) {
+    i = (first + j) % samples;
+    a = scramble_CAxx(address[i]);
+    d = scramble_CDxx(data[i]);
+    c = scramble_CCxx(control[i], &a, &d);
+    if (trig_hit(trigFast, &trigFastMatch, a, c, d)) {
+      tla_printf("The trigger fires at sample %d.\n", j);
+      list_page_around(j);
+      return;
+    }
+  }
+  tla_printf("The trigger doesn't fire in the recorded samples.\n");
+}
+
+// Compile the trigger settings for the capture loop, and check the
+// program.  Returns false if it can't be armed.
+bool
+setup_triggers(void)
+{
+  int worst;
+
+  trig_compile();
+  return trig_check(&worst);
+}
+
+// Arm the analyzer, wait for the trigger and fill the sample buffer
+// with consecutive bus cycles (cm_samples), a write log (cm_writes) or
+// compressed bus cycles (cm_compressed).
+// The triggers must already have been set up with setup_triggers().
+void
+acquire(capture_mode_t mode)
+{
+  triggerPressed = false;
+  trig_reset();
+
+  setBusEnabled(true);
+  digitalWriteFast(CORE_LED0_PIN, HIGH); // Indicates waiting for trigger
+
+  samplesTaken = 0;
+
+  if (mode == cm_writes) {
+    (*cpu_desc->writes)();
+  } else if (mode == cm_compressed) {
+    // If the trigger comes before the pretrigger part of the buffer
+    // fills, the rest still holds counts from an earlier capture.
+    recordsStored = 0;
+    memset(recordInfo, 0, sizeof(recordInfo));
+    (*cpu_desc->compress)();
+  } else {
+    (*cpu_desc->capture)();
+  }
+  captureCyccnt = ARM_DWT_CYCCNT;
+  trigger_out_idle();
+
+  // Only the part after the trigger is timed; the wait for the trigger
+  // could be any length.
+  PERF_END(pf_capture, triggerCyccnt, samplesTaken);
+
+  setBusEnabled(false);
+
+  // The capture loop can only afford to snapshot the cycle counter;
+  // convert that to a micros() timestamp now.
+  triggerMicros = micros() - (ARM_DWT_CYCCNT - triggerCyccnt) / (F_CPU_ACTUAL / 1000000);
+
+  unscramble();
+  classify_cycles();
+  list_reset();
+  captureMode = mode;
+}
+
+// Start recording.
+void
+go(capture_mode_t mode)
+{
+  bool armed;
+
+  if (cpu_desc == NULL) {
+    tla_printf("No CPU type selected!\n");
+    return;
+  }
+
+  PERF_BEGIN(perf);
+  armed = setup_triggers();
+  PERF_END(pf_arm, perf, 1);
+  if (!armed) {
+    return;
+  }
+
+  tla_printf("Waiting for trigger...\n");
+  acquire(mode);
+  if (mode == cm_compressed) {
+    uint64_t cycles = 0;
+    char n[24];
+    int i;
+
+    for (i = 0; i < recordsStored; i++) {
+      cycles += 1 + (uint64_t)recordInfo[i];
+    }
+    tla_printf("Data recorded (%d records, %s bus cycles).\n", recordsStored,
+        u64_string(cycles, n));
+  } else {
+    tla_printf("Data recorded (%d %s).\n", samples,
+        mode == cm_writes ? "writes" : "samples");
+  }
+  show_trigger_out_latency();
+}
+
+#if defined(TLA_PERF)
+//
+// FIRMWARE PERFORMANCE COUNTERS
+//
+
+const struct perf_desc {
+  const char *name;
+  const char *item;                   // what the items are
+} perf_descs[pf_count] = {
+  { "arm",        "call" },
+  { "capture",    "sample" },
+  { "unscramble", "sample" },
+  { "classify",   "sample" },
+  { "list",       "line" },
+  { "export",     "line" },
+  { "write SD",   "byte" },
+  { "decode",     "byte" },
+};
+
+static double
+perf_ns(uint64_t cycles)
+{
+  return cycles * 1000.0 / (F_CPU_ACTUAL / 1000000);
+}
+
+void
+perf_report(void)
+{
+  const struct perf_counter *pc;
+  const struct perf_desc *pd;
+  int p;
+
+  tla_printf("%-10s %8s %11s %10s %14s\n", "", "calls", "total ms", "max us", "per item");
+  for (p = 0; p < pf_count; p++) {
+    pc = &perf_counters[p];
+    pd = &perf_descs[p];
+    if (pc->calls == 0) {
+      tla_printf("%-10s %8d\n", pd->name, 0);
+      continue;
+    }
+    tla_printf("%-10s %8lu %11.3f %10.1f", pd->name, pc->calls,
+        perf_ns(pc->cycles) / 1000000, perf_ns(pc->max) / 1000);
+    if (pc->items != 0) {
+      tla_printf(" %9.1f ns/%s", perf_ns(pc->cycles) / pc->items, pd->item);
+      if (strcmp(pd->item, "byte") == 0 && pc->cycles != 0) {
+        tla_printf(" (%.0f bytes/s)", pc->items * 1e9 / perf_ns(pc->cycles));
+      }
+    }
+    tla_printf("\n");
+  }
+}
+#endif // TLA_PERF
+
+//
+// THROUGHPUT BENCHMARKS
+//
+// "bench sd" and "bench usb" time writing a payload the size of a full
+// listing of the sample buffer, the way list and export do (Stream
+// writes of text), in several block sizes.  The SD card payload is
+// read back as well.  The worst stall is the longest single write or
+// read, which is what a capture being written out would have to wait.
+//
+#define BENCH_BYTES       (BUFFSIZE * 64)   // about one "list" line per sample
+#define BENCH_MAX_BLOCK   4096
+#define BENCH_MAX_RESULTS 8
+#define BENCH_FILE        "bench.tmp"
+#define BENCH_RESULTS     "bench.txt"
+
+const int benchBlockSizes[] = { 64, 512, BENCH_MAX_BLOCK };
+#define BENCH_BLOCK_SIZES (int)(sizeof(benchBlockSizes) / sizeof(benchBlockSizes[0]))
+
+struct bench_result {
+  const char *what;
+  int         block;
+  uint32_t    bytes;
+  uint32_t    elapsed;                // microseconds
+  uint32_t    stall;                  // longest single transfer, microseconds
+};
+
+// Fill buf with lines of text, like a listing.
+static void
+bench_fill(uint8_t *buf, int len)
+{
+  int i;
+
+  for (i = 0; i < len; i++) {
+    buf[i] = (i % 64) == 63 ? '\n' : ' ' + (i % 64) + (i / 64) % 32;
+  }
+}
+
+// Write (or, if out is NULL, read) BENCH_BYTES in blocks of r->block
+// bytes.  Flushing what is still buffered at the end counts as a write.
+// Returns false if interrupted or the transfer came up short.
+static bool
+bench_run(Stream *out, File *in, struct bench_result *r)
+{
+  uint8_t buf[BENCH_MAX_BLOCK];
+  uint32_t start, t, n;
+  int len;
+
+  bench_fill(buf, r->block);
+  r->bytes = 0;
+  r->stall = 0;
+  start = micros();
+  while (r->bytes < BENCH_BYTES) {
+    if (userInterrupt()) {
+      return false;
+    }
+    len = r->block;
+    if (r->bytes + len > BENCH_BYTES) {
+      len = BENCH_BYTES - r->bytes;
+    }
+    t = micros();
+    n = out != NULL ? out->write(buf, len) : in->read(buf, len);
+    t = micros() - t;
+    if (t > r->stall) {
+      r->stall = t;
+    }
+    if (n != (uint32_t)len) {
+      return false;
+    }
+    r->bytes += n;
+  }
+  if (out != NULL) {
+    t = micros();
+    out->flush();
+    t = micros() - t;
+    if (t > r->stall) {
+      r->stall = t;
+    }
+  }
+  r->elapsed = micros() - start;
+  return true;
+}
+
+void
+bench_print(Stream &stream, const struct bench_result *r)
+{
+  char line[100];
+
+  sprintf(line, "%-9s %4d-byte blocks: %7.3f MB/s, worst stall %lu us",
+      r->what, r->block, r->elapsed ? (double)r->bytes / r->elapsed : 0.0, r->stall);
+  stream.println(line);
+}
+
+// Show the results, and add them to BENCH_RESULTS on the SD card.
+void
+bench_report(const char *title, const struct bench_result *results, int n)
+{
+  char line[60];
+  int i;
+
+  sprintf(line, "%s: %lu bytes per run", title, (uint32_t)BENCH_BYTES);
+  tla_printf("%s\n", line);
+  for (i = 0; i < n; i++) {
+    bench_print(Serial, &results[i]);
+  }
+
+  if (!SD.begin(BUILTIN_SDCARD)) {
+    return;
+  }
+  File file = SD.open(BENCH_RESULTS, FILE_WRITE);
+  if (!file) {
+    tla_printf("Unable to write %s\n", BENCH_RESULTS);
+    return;
+  }
+  file.println(line);
+  for (i = 0; i < n; i++) {
+    bench_print(file, &results[i]);
+  }
+  file.close();
+  tla_printf("Results added to %s\n", BENCH_RESULTS);
+}
+
+void
+bench_sd(void)
+{
+  struct bench_result results[BENCH_MAX_RESULTS], *r;
+  int b, n = 0;
+  File file;
+
+  if (!SD.begin(BUILTIN_SDCARD)) {
+    tla_printf("Unable to initialize internal SD card.\n");
+    return;
+  }
+
+  for (b = 0; b < BENCH_BLOCK_SIZES; b++) {
+    if (SD.exists(BENCH_FILE)) {
+      SD.remove(BENCH_FILE);
+    }
+    file = SD.open(BENCH_FILE, FILE_WRITE);
+    if (!file) {
+      tla_printf("Unable to write %s\n", BENCH_FILE);
+      return;
+    }
+
+    r = &results[n++];
+    r->what = "SD write";
+    r->block = benchBlockSizes[b];
+    if (!bench_run(&file, NULL, r)) {
+      file.close();
+      tla_printf("Write failed or interrupted.\n");
+      return;
+    }
+    file.close();
+
+    file = SD.open(BENCH_FILE);
+    if (!file) {
+      tla_printf("Unable to read %s\n", BENCH_FILE);
+      return;
+    }
+    r = &results[n++];
+    r->what = "SD read";
+    r->block = benchBlockSizes[b];
+    if (!bench_run(NULL, &file, r)) {
+      file.close();
+      tla_printf("Read failed or interrupted.\n");
+      return;
+    }
+    file.close();
+  }
+  SD.remove(BENCH_FILE);
+
+  bench_report("bench sd", results, n);
+}
+
+void
+bench_usb(void)
+{
+  struct bench_result results[BENCH_MAX_RESULTS], *r;
+  int b, n = 0;
+
+  for (b = 0; b < BENCH_BLOCK_SIZES; b++) {
+    r = &results[n++];
+    r->what = "USB write";
+    r->block = benchBlockSizes[b];
+    if (!bench_run(&Serial, NULL, r)) {
+      tla_printf("\nWrite failed or interrupted.\n");
+      return;
+    }
+  }
+  tla_printf("\n");
+
+  bench_report("bench usb", results, n);
+}
+
+//
+// SOAK MODE
+//
+// "soak" captures over and over, folding each capture into running
+// statistics that take the same amount of memory no matter how long
+// the run goes on.  Captures that match the archive predicate are also
+// written to the SD card in full.
+//
+#define SOAK_LATENCY_BUCKETS  32      // one bus cycle each; the last is "or more"
+#define SOAK_SYNC_CAPTURES    100     // how often the SD summary is rewritten
+#define SOAK_MAX_ARCHIVE      1000    // limit on captures archived to SD
+
+struct soak_stats {
+  uint32_t  captures;
+  uint32_t  archived;
+  uint32_t  elapsed;                  // milliseconds spent soaking
+
+  // Time between successive triggers, in microseconds.
+  bool      chained;                  // last_trigger is from this run
+  uint32_t  last_trigger;
+  uint32_t  intervals;
+  uint32_t  interval_min;
+  uint32_t  interval_max;
+  uint64_t  interval_total;
+
+  // Bus cycles from an interrupt request to its acknowledge.
+  uint32_t  interrupts;
+  uint32_t  acks;
+  uint32_t  latency_min;
+  uint32_t  latency_max;
+  uint32_t  latency[SOAK_LATENCY_BUCKETS];
+
+  // Anomalies.
+  uint32_t  resets;                   // captures with reset asserted
+  uint32_t  withdrawn;                // IRQ/FIRQ released before acknowledge
+
+  // Memory addresses the CPU has touched.
+  uint32_t  coverage;
+  uint8_t   covmap[65536 / 8];
+} soak;
+
+soak_archive_t soakArchive = sa_anomaly;
+int soakLatencyLimit = SOAK_LATENCY_BUCKETS - 1;
+
+void
+soak_reset(void)
+{
+  memset(&soak, 0, sizeof(soak));
+}
+
+// Returns true if sample i has a level-sensitive interrupt request
+// (IRQ or FIRQ) asserted.  NMI is edge-sensitive and handled separately.
+static bool
+soak_irq_asserted(int i, const struct cpu_signal *irq, const struct cpu_signal *firq)
+{
+  return (irq != NULL && cpu_signal_asserted(irq, control[i])) ||
+         (firq != NULL && cpu_signal_asserted(firq, control[i]));
+}
+
+// Fold the capture in the sample buffer into the soak statistics.
+// Returns true if the capture should be archived.
+bool
+soak_analyze(void)
+{
+  const struct cpu_signal *reset = cpu_signal_lookup(cpu_desc->tr_reset);
+  const struct cpu_signal *irq = cpu_signal_lookup(cpu_desc->tr_irq);
+  const struct cpu_signal *firq = cpu_signal_lookup(cpu_desc->tr_firq);
+  const struct cpu_signal *nmi = cpu_signal_lookup(cpu_desc->tr_nmi);
+  int first = (triggerPoint - pretrigger + samples) % samples;
+  bool reset_seen = false, anomaly = false, newcov = false, slow = false;
+  bool level, prev_level, edge, prev_edge;
+  bool pending = false, pending_level = false;
+  int pending_since = 0;
+  uint32_t a, t;
+  int i, j;
+
+  soak.captures++;
+
+  if (soak.chained) {
+    t = triggerMicros - soak.last_trigger;
+    if (soak.intervals == 0 || t < soak.interval_min) {
+      soak.interval_min = t;
+    }
+    if (t > soak.interval_max) {
+      soak.interval_max = t;
+    }
+    soak.interval_total += t;
+    soak.intervals++;
+  }
+  soak.last_trigger = triggerMicros;
+  soak.chained = true;
+
+  i = first;
+  prev_level = soak_irq_asserted(i, irq, firq);
+  prev_edge = nmi != NULL && cpu_signal_asserted(nmi, control[i]);
+
+  for (j = 0; j < samples; j++, i = (i + 1) % samples) {
+    switch (bus_cycle(i)) {
+      case bc_fetch:
+      case bc_read:
+      case bc_write:
+      case bc_vector:
+        a = address[i] & 0xffff;
+        if (!(soak.covmap[a >> 3] & (1U << (a & 7)))) {
+          soak.covmap[a >> 3] |= 1U << (a & 7);
+          soak.coverage++;
+          newcov = true;
+        }
+        break;
+
+      default:
+        break;
+    }
+
+    if (reset != NULL && cpu_signal_asserted(reset, control[i])) {
+      reset_seen = anomaly = true;
+    }
+
+    level = soak_irq_asserted(i, irq, firq);
+    edge = nmi != NULL && cpu_signal_asserted(nmi, control[i]);
+    if (!pending && ((level && !prev_level) || (edge && !prev_edge))) {
+      pending = true;
+      pending_level = !(edge && !prev_edge);
+      pending_since = j;
+      soak.interrupts++;
+    }
+    if (pending && cpu_int_ack(i)) {
+      t = j - pending_since;
+      if (soak.acks == 0 || t < soak.latency_min) {
+        soak.latency_min = t;
+      }
+      if (t > soak.latency_max) {
+        soak.latency_max = t;
+      }
+      soak.latency[t < SOAK_LATENCY_BUCKETS ? t : SOAK_LATENCY_BUCKETS - 1]++;
+      soak.acks++;
+      if ((int)t >= soakLatencyLimit) {
+        slow = true;
+      }
+      pending = false;
+    } else if (pending && pending_level && !level) {
+      soak.withdrawn++;
+      anomaly = true;
+      pending = false;
+    }
+    prev_level = level;
+    prev_edge = edge;
+  }
+  if (reset_seen) {
+    soak.resets++;
+  }
+
+  switch (soakArchive) {
+    case sa_all:      return true;
+    case sa_anomaly:  return anomaly;
+    case sa_coverage: return newcov && soak.captures > 1;
+    case sa_latency:  return slow;
+    default:          return false;
+  }
+}
+
+void
+soak_summary(Stream &stream)
+{
+  char line[80];
+  uint32_t secs = soak.elapsed / 1000;
+  int b;
+
+  sprintf(line, "Soak: %lu captures in %lu:%02lu:%02lu, %lu archived",
+      soak.captures, secs / 3600, (secs / 60) % 60, secs % 60, soak.archived);
+  stream.println(line);
+  if (soak.intervals != 0) {
+    sprintf(line, "Trigger interval: min %lu us, avg %lu us, max %lu us",
+        soak.interval_min, (uint32_t)(soak.interval_total / soak.intervals),
+        soak.interval_max);
+    stream.println(line);
+  }
+  sprintf(line, "Interrupts: %lu requested, %lu acknowledged",
+      soak.interrupts, soak.acks);
+  stream.println(line);
+  if (soak.acks != 0) {
+    sprintf(line, "Interrupt latency: min %lu, max %lu cycles",
+        soak.latency_min, soak.latency_max);
+    stream.println(line);
+    for (b = 0; b < SOAK_LATENCY_BUCKETS; b++) {
+      if (soak.latency[b] != 0) {
+        sprintf(line, "  %s%2d cycles: %lu", b == SOAK_LATENCY_BUCKETS - 1 ? ">=" : "  ",
+            b, soak.latency[b]);
+        stream.println(line);
+      }
+    }
+  }
+  sprintf(line, "Anomalies: %lu captures with reset, %lu interrupts withdrawn",
+      soak.resets, soak.withdrawn);
+  stream.println(line);
+  sprintf(line, "Coverage: %lu addresses", soak.coverage);
+  stream.println(line);
+}
+
+// Rewrite the summary and coverage bitmap on the SD card.
+void
+soak_sync(void)
+{
+  const char *SUMMARY_FILE = "soak.txt";
+  const char *COVERAGE_FILE = "soakcov.bin";
+  File file;
+
+  if (SD.exists(SUMMARY_FILE)) {
+    SD.remove(SUMMARY_FILE);
+  }
+  file = SD.open(SUMMARY_FILE, FILE_WRITE);
+  if (file) {
+    soak_summary(file);
+    file.close();
+  }
+
+  if (SD.exists(COVERAGE_FILE)) {
+    SD.remove(COVERAGE_FILE);
+  }
+  file = SD.open(COVERAGE_FILE, FILE_WRITE);
+  if (file) {
+    file.write(soak.covmap, sizeof(soak.covmap));
+    file.close();
+  }
+}
+
+// Write the capture in the sample buffer to the SD card.
+void
+soak_archive_capture(void)
+{
+  char name[16];
+
+  sprintf(name, "soak%lu.csv", soak.captures);
+  if (SD.exists(name)) {
+    SD.remove(name);
+  }
+  File file = SD.open(name, FILE_WRITE);
+  if (file) {
+    exportCSV(file, samplesTaken);
+    file.close();
+    soak.archived++;
+  }
+}
+
+// Capture count times (forever if count is 0) or until interrupted.
+void
+soak_run(uint32_t count)
+{
+  bool have_sd;
+  uint32_t n, now, then;
+
+  have_sd = SD.begin(BUILTIN_SDCARD);
+  if (!have_sd) {
+    tla_printf("Unable to initialize internal SD card; nothing will be saved.\n");
+  }
+
+  if (!setup_triggers()) {
+    return;
+  }
+  soak.chained = false;
+
+  tla_printf("Soaking; type Ctrl-C to stop after the current capture.\n");
+  then = millis();
+  for (n = 0; count == 0 || n < count; n++) {
+    if (userInterrupt()) {
+      break;
+    }
+    acquire(cm_samples);
+    if (soak_analyze() && have_sd && soak.archived < SOAK_MAX_ARCHIVE) {
+      soak_archive_capture();
+    }
+    now = millis();
+    soak.elapsed += now - then;
+    then = now;
+
+    if (soak.captures % SOAK_SYNC_CAPTURES == 0) {
+      tla_printf("%lu captures\n", soak.captures);
+      if (have_sd) {
+        soak_sync();
+      }
+    }
+  }
+  if (have_sd) {
+    soak_sync();
+  }
+  soak_summary(Serial);
+}
+
+//
+// LIVE MONITOR
+//
+// "monitor" captures windows of "samples" bus cycles over and over and
+// prints the instructions fetched in each, like "tail -f" for the
+// target.  The USB controller sends one window's text while the next
+// window is being captured.  A window whose text doesn't fit in what is
+// left of the serial transmit buffer is dropped whole rather than
+// holding up the next capture, and the bus cycles that went by without
+// being shown are estimated from the cycle counter.
+//
+
+// Print the instructions in the sample buffer, one per line, or just
+// work out how long the text would be.  Returns the length of the text.
+static int
+monitor_format(bool print)
+{
+  int first = (triggerPoint - pretrigger + samples) % samples;
+  struct insn_decode id;
+  char line[6 + INSN_DECODE_MAXSTRING + 2];
+  int i, j, n, len = 0;
+
+  insn_decode_init(&id, cpu_desc->decode);
+  for (j = 0; j < samples; j++) {
+    i = (first + j) % samples;
+    if ((list_decode_sample(&id, i) || bus_cycle(i) == bc_fetch) &&
+        id.state == ds_complete) {
+      n = sprintf(line, "%04lX  %s\r\n", id.insn_address, id.insn_string);
+      if (print) {
+        Serial.write((const uint8_t *)line, n);
+      }
+      len += n;
+    }
+  }
+  return len;
+}
+
+void
+monitor_run(void)
+{
+  uint32_t windows = 0, dropped = 0, unshown_windows = 0;
+  uint64_t shown = 0, skipped = 0, unshown = 0, gap;
+  uint32_t prevCyccnt = 0, start;
+  int txsize, len;
+  double period;
+  char n1[24], n2[24];
+
+  if (!setup_triggers()) {
+    return;
+  }
+
+  tla_printf("Monitoring; type Ctrl-C to stop.\n");
+  Serial.flush();
+  txsize = Serial.availableForWrite();
+
+  while (!userInterrupt()) {
+    acquire(cm_samples);
+
+    // The CPU cycles per bus cycle in this window give the number of bus
+    // cycles since the end of the previous one.  If the whole buffer is
+    // pretrigger, nothing was timed and the gap isn't counted.
+    period = samplesTaken != 0 ?
+        (double)(captureCyccnt - triggerCyccnt) / samplesTaken : 0;
+    start = triggerCyccnt - (uint32_t)(pretrigger * period);
+    if (windows++ != 0 && period > 0) {
+      gap = (uint64_t)((start - prevCyccnt) / period);
+      skipped += gap;
+      unshown += gap;
+    }
+    prevCyccnt = captureCyccnt;
+
+    // The second pass is cheap; it hits the decode cache.  A window too
+    // big for the whole buffer is shown anyway, once the buffer drains.
+    len = monitor_format(false);
+    if (len > Serial.availableForWrite() && Serial.availableForWrite() < txsize) {
+      dropped++;
+      unshown_windows++;
+      skipped += samples;
+      unshown += samples;
+      continue;
+    }
+    if (unshown_windows != 0) {
+      tla_printf("-- %lu windows dropped, %s cycles skipped --\n",
+          unshown_windows, u64_string(unshown, n1));
+    }
+    monitor_format(true);
+    shown += samples;
+    unshown = 0;
+    unshown_windows = 0;
+  }
+
+  tla_printf("^C\n");
+  tla_printf("%lu windows, %lu dropped; %s bus cycles shown, about %s skipped\n",
+      windows, dropped, u64_string(shown, n1), u64_string(skipped, n2));
+}
+
+//
+// EVENT COUNTER
+//
+// "count" watches the bus without storing anything, counting the
+// cycles that match each counter term (see count_events()).
+//
+
+// Format a 64-bit unsigned number; printf() may not support %llu.
+char *
+u64_string(uint64_t v, char *buf)
+{
+  char tmp[24], *cp = tmp;
+
+  char *bp = buf;
+
+  do {
+    *cp++ = '0' + (v % 10);
+    v /= 10;
+  } while (v != 0);
+  while (cp != tmp) {
+    *bp++ = *--cp;
+  }
+  *bp = '\0';
+  return buf;
+}
+
+void
+count_report(void)
+{
+  char desc[80], n1[24], n2[24], n3[24];
+  struct count_term *ct;
+  int t;
+
+  tla_printf("%lu.%03lu s, %s bus cycles", countMillis / 1000, countMillis % 1000,
+      u64_string(countCycles, n1));
+  if (countMillis != 0) {
+    tla_printf(" (%lu kHz)", (uint32_t)(countCycles / countMillis));
+  }
+  tla_printf("\n");
+
+  for (t = 0; t < countTermCount; t++) {
+    ct = &countTerms[t];
+    describe_match(desc, &ct->spec);
+    tla_printf("%d: %s: %s\n", t + 1, desc, u64_string(ct->count, n1));
+    if (ct->count > 1) {
+      tla_printf("   interval min %s, avg %s, max %s cycles",
+          u64_string(ct->interval_min, n1),
+          u64_string(ct->interval_total / (ct->count - 1), n2),
+          u64_string(ct->interval_max, n3));
+      // In floating point, since total * millis overflows within hours.
+      if (countCycles != 0) {
+        tla_printf(" (avg %.1f us)", (double)ct->interval_total / (ct->count - 1) *
+            countMillis * 1000 / countCycles);
+      }
+      tla_printf("\n");
+    }
+  }
+}
+
+void
+count_reset(void)
+{
+  int t;
+
+  for (t = 0; t < countTermCount; t++) {
+    struct match_spec spec = countTerms[t].spec;
+    memset(&countTerms[t], 0, sizeof(countTerms[t]));
+    countTerms[t].spec = spec;
+  }
+  countCycles = 0;
+  countMillis = 0;
+}
+
+// Count events for the given number of seconds (0 = until Ctrl-C).
+void
+count_run(uint32_t seconds)
+{
+  struct count_term *ct;
+  int t;
+
+  for (t = 0; t < countTermCount; t++) {
+    ct = &countTerms[t];
+    encode_match(&ct->spec, &ct->match);
+    ct->edge = ct->spec.mode != tr_address && ct->spec.mode != tr_data &&
+               ct->spec.mode != tr_addr_data;
+    ct->matched = false;
+  }
+  countDuration = seconds * 1000;
+
+  tla_printf("Counting; type Ctrl-C to stop.\n");
+  setBusEnabled(true);
+  (*cpu_desc->count)();
+  setBusEnabled(false);
+  count_report();
+}
+
+//
+// MEMORY WATCH
+//
+// "watch" follows the values at a few addresses (or Z80 I/O ports) as
+// the target runs, without storing any samples (see watch_events()).
+//
+
+// Print the watched addresses whose value or access count has changed
+// since the last update, on one line.
+void
+watch_update(void)
+{
+  struct watch_slot *ws;
+  bool any = false;
+  int i;
+
+  for (i = 0; i < watchSlotCount; i++) {
+    ws = &watchSlots[i];
+    if (!ws->valid ||
+        (ws->value == ws->shown && ws->reads + ws->writes == ws->shown_accesses)) {
+      continue;
+    }
+    if (!any) {
+      tla_printf("%4lu.%03lu s ", watchMillis / 1000, watchMillis % 1000);
+      any = true;
+    }
+    tla_printf(" %0*X=%02X", watchSpace == tr_io ? 2 : 4, ws->addr, ws->value);
+    ws->shown = ws->value;
+    ws->shown_accesses = ws->reads + ws->writes;
+  }
+  if (any) {
+    tla_printf("\n");
+  }
+}
+
+void
+watch_show(void)
+{
+  const struct watch_slot *ws;
+  int i;
+
+  if (watchSlotCount == 0) {
+    tla_printf("Nothing is being watched.\n");
+    return;
+  }
+  tla_printf("%s   value  last        reads     writes\n",
+      watchSpace == tr_io ? "port" : "addr");
+  for (i = 0; i < watchSlotCount; i++) {
+    ws = &watchSlots[i];
+    if (watchSpace == tr_io) {
+      tla_printf("  %02X", ws->addr);
+    } else {
+      tla_printf("%04X", ws->addr);
+    }
+    if (ws->valid) {
+      tla_printf("   %02X     %-5s", ws->value, ws->written ? "write" : "read");
+    } else {
+      tla_printf("   --     %-5s", "");
+    }
+    tla_printf(" %10lu %10lu\n", ws->reads, ws->writes);
+  }
+}
+
+void
+watch_run(void)
+{
+  struct watch_slot *ws;
+  int i;
+
+  memset(watchMap, 0, sizeof(watchMap));
+  for (i = 0; i < watchSlotCount; i++) {
+    ws = &watchSlots[i];
+    watchMap[ws->addr >> 3] |= 1U << (ws->addr & 7);
+    ws->valid = false;
+    ws->reads = ws->writes = 0;
+    ws->shown_accesses = 0;
+  }
+  watchMillis = 0;
+
+  tla_printf("Watching; type Ctrl-C to stop.\n");
+  setBusEnabled(true);
+  (*cpu_desc->watch)();
+  setBusEnabled(false);
+  watch_show();
+}
+
+//
+// ADDRESS-RANGE HISTOGRAM
+//
+// "hist" charges every bus cycle to one of the user's address ranges
+// (see histogram_events()), to show where the CPU spends its time.
+//
+
+void
+hist_report(void)
+{
+  uint64_t total = 0;
+  char n1[24];
+  int r;
+
+  for (r = 0; r <= HIST_RANGES; r++) {
+    total += histCycles[r];
+  }
+  tla_printf("%lu.%03lu s, %s bus cycles\n", histMillis / 1000, histMillis % 1000,
+      u64_string(total, n1));
+  for (r = 0; r <= histRangeCount; r++) {
+    // Per-mille, so we can show one decimal place without floating point.
+    uint32_t pm = total != 0 ? (uint32_t)(histCycles[r] * 1000 / total) : 0;
+    if (r == 0) {
+      tla_printf("%-*s            ", HIST_NAMELEN, "(other)");
+    } else {
+      const struct hist_range *hr = &histRanges[r - 1];
+      tla_printf("%-*s %04X-%04X  ", HIST_NAMELEN, hr->name, hr->first, hr->last);
+    }
+    tla_printf("%20s %3lu.%lu%%\n", u64_string(histCycles[r], n1), pm / 10, pm % 10);
+  }
+}
+
+void
+hist_reset(void)
+{
+  memset(histCycles, 0, sizeof(histCycles));
+  histMillis = 0;
+}
+
+// Run the histogram for the given number of seconds (0 = until Ctrl-C).
+void
+hist_run(uint32_t seconds)
+{
+  int r;
+
+  // Later ranges take precedence where ranges overlap.
+  memset(histRangeMap, 0, sizeof(histRangeMap));
+  for (r = 0; r < histRangeCount; r++) {
+    memset(&histRangeMap[histRanges[r].first], r + 1,
+        histRanges[r].last - histRanges[r].first + 1);
+  }
+  histDuration = seconds * 1000;
+
+  tla_printf("Running; type Ctrl-C to stop.\n");
+  setBusEnabled(true);
+  (*cpu_desc->histogram)();
+  setBusEnabled(false);
+  hist_report();
+}
+
+//
+// INSTRUCTION MIX
+//
+
+// Copy a decoded instruction to dst with the operand values replaced by
+// n's, e.g. "LDA #$12" -> "LDA #$nn", "JP 1C00h" -> "JP nnnnh" and
+// "BNE -5 <1000>" -> "BNE n".  Numbers are $ or h hex, or decimal.
+void
+mix_normalize(char *dst, const char *src)
+{
+  const char *end = src + strlen(src);
+  const char *cp, *digits;
+  char *start = dst;
+
+  // Drop the " <addr>" resolved address; 6809 direct mode is "< $nn".
+  if (end - src >= 7 && end[-7] == ' ' && end[-6] == '<' && end[-1] == '>') {
+    end -= 7;
+  }
+  while (src < end) {
+    if (dst == start || isalnum((unsigned char)dst[-1])) {
+      *dst++ = *src++;
+      continue;
+    }
+    // At the start of a word; see if it's a number.
+    digits = src + (*src == '$' || *src == '-');
+    for (cp = digits; cp < end && isxdigit((unsigned char)*cp); cp++) {
+      ;
+    }
+    if (cp == digits) {
+      *dst++ = *src++;
+    } else if (*src == '$' || (cp < end && *cp == 'h')) {
+      // Hex: one n per digit, so nn and nnnn are told apart.
+      if (*src == '$') {
+        *dst++ = *src++;
+      }
+      for (; src < cp; src++) {
+        *dst++ = 'n';
+      }
+    } else if (strspn(digits, "0123456789") >= (size_t)(cp - digits)) {
+      *dst++ = 'n';
+      src = cp;
+    } else {
+      // A word that happens to start with A-F, like "ADD".
+      while (src < cp) {
+        *dst++ = *src++;
+      }
+    }
+  }
+  // Drop the padding some decoders put after relative offsets.
+  while (dst > start && dst[-1] == ' ') {
+    dst--;
+  }
+  *dst = '\0';
+}
+
+// Count one instruction in mixTable.  Returns false if the table is full.
+static bool
+mix_count(const char *insn)
+{
+  char key[INSN_DECODE_MAXSTRING];
+  int i;
+
+  mix_normalize(key, insn);
+  for (i = 0; i < mixEntries; i++) {
+    if (strcmp(mixTable[i].insn, key) == 0) {
+      mixTable[i].count++;
+      return true;
+    }
+  }
+  if (mixEntries == MIX_ENTRIES) {
+    return false;
+  }
+  strcpy(mixTable[mixEntries].insn, key);
+  mixTable[mixEntries++].count = 1;
+  return true;
+}
+
+static int
+mix_compare(const void *a, const void *b)
+{
+  const struct mix_entry *ma = (const struct mix_entry *)a;
+  const struct mix_entry *mb = (const struct mix_entry *)b;
+
+  if (ma->count != mb->count) {
+    return ma->count < mb->count ? 1 : -1;
+  }
+  return strcmp(ma->insn, mb->insn);
+}
+
+static int
+mix_compare_insn(const void *a, const void *b)
+{
+  return strcmp(((const struct mix_entry *)a)->insn,
+      ((const struct mix_entry *)b)->insn);
+}
+
+static void
+mix_print(uint32_t total, int lines)
+{
+  int i;
+
+  qsort(mixTable, mixEntries, sizeof(mixTable[0]), mix_compare);
+  for (i = 0; i < mixEntries && (lines == 0 || i < lines); i++) {
+    tla_printf("  %-28s %7lu %5.1f%%\n", mixTable[i].insn,
+        mixTable[i].count, 100.0 * mixTable[i].count / total);
+  }
+  if (i < mixEntries) {
+    tla_printf("  (%d more)\n", mixEntries - i);
+  }
+}
+
+// Report the instruction mix of the sample buffer: the lines most
+// frequent instruction forms and then the most frequent mnemonics (all
+// of them if lines is 0).
+void
+mix_report(int lines)
+{
+  int first = (triggerPoint - pretrigger + samples) % samples;
+  struct insn_decode id;
+  uint32_t total = 0;
+  bool full = false;
+  char *cp;
+  int i, j;
+
+  if (cpu == cpu_none || samplesTaken == 0 || captureMode != cm_samples) {
+    tla_printf("No samples to analyze.\n");
+    return;
+  }
+
+  mixEntries = 0;
+  insn_decode_init(&id, cpu_desc->decode);
+  for (j = 0; j < samples; j++) {
+    i = (first + j) % samples;
+    // Count each instruction on the sample that completes it.
+    if ((list_decode_sample(&id, i) || bus_cycle(i) == bc_fetch) &&
+        id.state == ds_complete) {
+      if (mix_count(id.insn_string)) {
+        total++;
+      } else {
+        full = true;
+      }
+    }
+  }
+  if (total == 0) {
+    tla_printf("No complete instructions in the sample data.\n");
+    return;
+  }
+
+  tla_printf("Instruction mix (%lu instructions):\n", total);
+  mix_print(total, lines);
+  if (full) {
+    tla_printf("Too many different instructions; some weren't counted.\n");
+  }
+
+  // Fold the table down to mnemonics.
+  for (i = 0; i < mixEntries; i++) {
+    if ((cp = strchr(mixTable[i].insn, ' ')) != NULL) {
+      *cp = '\0';
+    }
+  }
+  qsort(mixTable, mixEntries, sizeof(mixTable[0]), mix_compare_insn);
+  for (i = 0, j = 0; i < mixEntries; i++) {
+    if (j != 0 && strcmp(mixTable[j - 1].insn, mixTable[i].insn) == 0) {
+      mixTable[j - 1].count += mixTable[i].count;
+    } else {
+      mixTable[j++] = mixTable[i];
+    }
+  }
+  mixEntries = j;
+  tla_printf("\nBy mnemonic:\n");
+  mix_print(total, lines);
+}
+
+//
+// STATIC LISTING
+//
+
+// Find the codeTable entry for the instruction id has decoded, adding
+// one if need be.  Returns NULL if the table is full.
+static struct code_entry *
+code_lookup(const struct insn_decode *id)
+{
+  uint32_t h = ((id->insn_address & 0xffff) * 2654435761U) >> 21;
+  struct code_entry *ce;
+  int n;
+
+  for (n = 0; n < CODE_ENTRIES; n++, h = (h + 1) & (CODE_ENTRIES - 1)) {
+    ce = &codeTable[h];
+    if (ce->len == 0) {
+      if (codeEntries >= CODE_ENTRIES - CODE_ENTRIES / 8) {
+        return NULL;                  // keep the probe chains short
+      }
+      ce->addr = id->insn_address;
+      ce->len = id->bytes_fetched;
+      memcpy(ce->bytes, id->bytes, id->bytes_fetched);
+      ce->count = 0;
+      codeEntries++;
+      return ce;
+    }
+    if (ce->addr == (id->insn_address & 0xffff) && ce->len == id->bytes_fetched &&
+        memcmp(ce->bytes, id->bytes, ce->len) == 0) {
+      return ce;
+    }
+  }
+  return NULL;
+}
+
+// Add the instructions in the sample buffer to the static listing.
+void
+code_add(void)
+{
+  int first = (triggerPoint - pretrigger + samples) % samples;
+  struct insn_decode id;
+  struct code_entry *ce;
+  uint32_t next = ~0U, added = 0;
+  int i, j, before = codeEntries;
+
+  if (cpu == cpu_none || samplesTaken == 0 || captureMode != cm_samples) {
+    tla_printf("No samples to add.\n");
+    return;
+  }
+
+  insn_decode_init(&id, cpu_desc->decode);
+  for (j = 0; j < samples; j++) {
+    i = (first + j) % samples;
+    if ((!list_decode_sample(&id, i) && bus_cycle(i) != bc_fetch) ||
+        id.state != ds_complete) {
+      continue;
+    }
+    if ((ce = code_lookup(&id)) == NULL) {
+      tla_printf("Static listing is full (%d instructions).\n", codeEntries);
+      break;
+    }
+    ce->count++;
+    added++;
+    // Execution that didn't fall through to here got here some other way.
+    if (next != ~0U && ce->addr != next) {
+      codeTargets[ce->addr >> 3] |= 1U << (ce->addr & 7);
+    }
+    next = (ce->addr + ce->len) & 0xffff;
+  }
+  codeCaptures++;
+  tla_printf("Added %lu instructions, %d of them new.\n", added, codeEntries - before);
+}
+
+void
+code_clear(void)
+{
+  memset(codeTable, 0, sizeof(codeTable));
+  memset(codeTargets, 0, sizeof(codeTargets));
+  codeEntries = 0;
+  codeCaptures = 0;
+}
+
+static int
+code_compare(const void *a, const void *b)
+{
+  const struct code_entry *ca = &codeTable[*(const uint16_t *)a];
+  const struct code_entry *cb = &codeTable[*(const uint16_t *)b];
+
+  if (ca->addr != cb->addr) {
+    return ca->addr < cb->addr ? -1 : 1;
+  }
+  return memcmp(ca->bytes, cb->bytes, INSN_DECODE_MAXBYTES);
+}
+
+static bool
+code_target_p(uint32_t addr)
+{
+  return (codeTargets[(addr & 0xffff) >> 3] & (1U << (addr & 7))) != 0;
+}
+
+// Name the region, if any, that addr is in.
+static const char *
+code_region(uint32_t addr)
+{
+  const struct cpu_region *reg;
+
+  for (reg = cpu_desc->regions; reg->name != NULL; reg++) {
+    if (addr >= reg->first && addr <= reg->last) {
+      return reg->name;
+    }
+  }
+  return NULL;
+}
+
+// List the static listing in address order.  Addresses that execution
+// jumped to are labelled Lxxxx, and so are branch targets that refer
+// to them.  Returns false if interrupted.
+bool
+code_list(Stream &stream)
+{
+  struct insn_decode id;
+  struct code_entry *ce;
+  char output[120], label[8], bytes[3 * INSN_DECODE_MAXBYTES + 1], comment[40];
+  const char *name;
+  uint32_t next = ~0U;
+  int i, k, n;
+
+  for (i = 0, n = 0; i < CODE_ENTRIES; i++) {
+    if (codeTable[i].len != 0) {
+      codeOrder[n++] = i;
+    }
+  }
+  qsort(codeOrder, n, sizeof(codeOrder[0]), code_compare);
+
+  sprintf(output, "; %d instructions from %lu captures", n, codeCaptures);
+  stream.println(output);
+  for (i = 0; i < n; i++) {
+    if (&stream == &Serial && userInterrupt()) {
+      tla_printf("^C\n");
+      return false;
+    }
+    ce = &codeTable[codeOrder[i]];
+    if (ce->addr != next) {
+      stream.println("");
+    }
+    next = (ce->addr + ce->len) & 0xffff;
+
+    insn_decode_init(&id, cpu_desc->decode);
+    insn_decode_begin(&id, ce->addr, ce->bytes[0]);
+    for (k = 1; k < ce->len; k++) {
+      insn_decode_continue(&id, ce->bytes[k]);
+    }
+    for (k = 0; k < ce->len; k++) {
+      sprintf(&bytes[3 * k], "%02X ", ce->bytes[k]);
+    }
+
+    label[0] = '\0';
+    if (code_target_p(ce->addr)) {
+      sprintf(label, "L%04X:", ce->addr);
+    }
+    comment[0] = '\0';
+    if (id.resolved_address_valid) {
+      if ((name = code_region(id.resolved_address)) != NULL) {
+        sprintf(comment, "-> %s", name);
+      } else if (code_target_p(id.resolved_address)) {
+        sprintf(comment, "-> L%04lX", id.resolved_address & 0xffff);
+      }
+    }
+    sprintf(output, "%8lu  %-6s %04X  %-12s %-28s %s",
+        ce->count, label, ce->addr, bytes, insn_decode_complete(&id), comment);
+    stream.println(output);
+  }
+  return true;
+}
+
+//
+// MEMORY IMAGE
+//
+
+bool
+mem_image_byte(uint32_t addr, uint8_t *bp)
+{
+  addr &= 0xffff;
+  if (memImageValid[addr >> 3] & (1U << (addr & 7))) {
+    *bp = memImage[addr];
+    return true;
+  }
+  return false;
+}
+
+void
+mem_image_set(uint32_t addr, uint8_t b)
+{
+  addr &= 0xffff;
+  memImage[addr] = b;
+  memImageValid[addr >> 3] |= 1U << (addr & 7);
+}
+
+// Decode the instruction at addr with opcode op, taking the rest of its
+// bytes from the memory image.  Returns "" if they aren't all there.
+const char *
+mem_image_decode(struct insn_decode *id, uint32_t addr, uint8_t op)
+{
+  uint8_t b;
+
+  insn_decode_init_uncached(id, cpu_desc->decode);
+  insn_decode_begin(id, addr, op);
+  while (id->state == ds_fetching) {
+    if (!mem_image_byte(addr + id->bytes_fetched, &b)) {
+      return "";
+    }
+    insn_decode_continue(id, b);
+  }
+  return insn_decode_complete(id);
+}
+
+// Load a binary file from the SD card into the memory image at addr.
+// Returns the number of bytes loaded, or -1 if the file can't be read.
+long
+mem_image_load_binary(File &file, uint32_t addr)
+{
+  uint8_t buf[512];
+  long total = 0;
+  int n, j;
+
+  while (addr + total <= 0xffff && (n = file.read(buf, sizeof(buf))) > 0) {
+    for (j = 0; j < n && addr + total <= 0xffff; j++, total++) {
+      mem_image_set(addr + total, buf[j]);
+    }
+  }
+  return total;
+}
+
+static int
+hex_nibble(int c)
+{
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+// Load one Intel HEX record into the memory image, offset by offset.
+// *basep carries the extended address from one record to the next.
+// Returns the number of bytes loaded, IHEX_EOF for the end of file
+// record or IHEX_ERROR if the record is bad.
+#define IHEX_EOF    -1
+#define IHEX_ERROR  -2
+int
+mem_image_ihex_record(const char *line, uint32_t *basep, uint32_t offset)
+{
+  uint8_t rec[5 + 255];           // count, address (2), type, data, sum
+  uint8_t sum = 0;
+  uint32_t addr;
+  int n, j, hi, lo;
+
+  if (*line++ != ':') {
+    return IHEX_ERROR;
+  }
+  for (n = 0; n < (int)sizeof(rec); n++, line += 2) {
+    if ((hi = hex_nibble(line[0])) < 0 || (lo = hex_nibble(line[1])) < 0) {
+      break;
+    }
+    rec[n] = (hi << 4) | lo;
+    sum += rec[n];
+  }
+  if (n < 5 || n != rec[0] + 5 || sum != 0) {
+    return IHEX_ERROR;
+  }
+
+  switch (rec[3]) {
+    case 0x00:                    // data
+      addr = *basep + ((rec[1] << 8) | rec[2]) + offset;
+      for (j = 0, n = 0; j < rec[0]; j++) {
+        // Anything beyond 64K isn't visible on the bus.
+        if (addr + j <= 0xffff) {
+          mem_image_set(addr + j, rec[4 + j]);
+          n++;
+        }
+      }
+      return n;
+
+    case 0x01:                    // end of file
+      return IHEX_EOF;
+
+    case 0x02:                    // extended segment address
+    case 0x04:                    // extended linear address
+      if (rec[0] != 2) {
+        return IHEX_ERROR;
+      }
+      *basep = ((rec[4] << 8) | rec[5]) << (rec[3] == 0x02 ? 4 : 16);
+      return 0;
+
+    default:                      // start addresses
+      return 0;
+  }
+}
+
+// Read a line from stream.  On the console, wait for input and give up
+// on Ctrl-C.  Returns the length of the line, 0 at the end of a file or
+// -1 if interrupted.
+static int
+mem_image_read_line(Stream &stream, bool console, char *buf, int len)
+{
+  int c, n = 0;
+
+  while (true) {
+    c = stream.read();
+    if (c == -1) {
+      if (console) {
+        continue;
+      }
+      break;
+    }
+    if (console && c == 0x03) {
+      return -1;
+    }
+    if (c == '\r' || c == '\n') {
+      if (n == 0) {
+        continue;
+      }
+      break;
+    }
+    if (n < len - 1) {
+      buf[n++] = c;
+    }
+  }
+  buf[n] = '\0';
+  return n;
+}
+
+// Load Intel HEX records from stream until the end of file record.
+// Returns the number of bytes loaded, or -1 on error.
+long
+mem_image_load_ihex(Stream &stream, bool console, uint32_t offset)
+{
+  char line[2 * (5 + 255) + 4];
+  uint32_t base = 0;
+  long total = 0;
+  int n, lineno;
+
+  for (lineno = 1;; lineno++) {
+    n = mem_image_read_line(stream, console, line, sizeof(line));
+    if (n < 0) {
+      tla_printf("^C\n");
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    n = mem_image_ihex_record(line, &base, offset);
+    if (n == IHEX_EOF) {
+      break;
+    }
+    if (n == IHEX_ERROR) {
+      tla_printf("Bad Intel HEX record at line %d.\n", lineno);
+      return -1;
+    }
+    total += n;
+  }
+  return total;
+}
+
+// Load a file from the SD card into the memory image: Intel HEX if its
+// name ends in .hex or .ihx (offset by addr), otherwise binary at addr.
+// Returns the number of bytes loaded, or -1 if the file can't be read.
+long
+mem_image_load(const char *name, uint32_t addr)
+{
+  const char *ext = strrchr(name, '.');
+  long n;
+
+  if (!SD.begin(BUILTIN_SDCARD)) {
+    tla_printf("Unable to initialize internal SD card.\n");
+    return -1;
+  }
+  File file = SD.open(name, FILE_READ);
+  if (!file) {
+    tla_printf("Unable to read %s\n", name);
+    return -1;
+  }
+  if (ext != NULL && (strcasecmp(ext, ".hex") == 0 || strcasecmp(ext, ".ihx") == 0)) {
+    n = mem_image_load_ihex(file, false, addr);
+  } else {
+    n = mem_image_load_binary(file, addr);
+  }
+  file.close();
+  return n;
+}
+
+// Disassemble count instructions from the memory image, starting at addr.
+void
+mem_image_disassemble(uint32_t addr, int count)
+{
+  struct insn_decode id;
+  const char *insn;
+  char bytes[3 * INSN_DECODE_MAXBYTES + 1];
+  uint8_t op;
+  int n;
+
+  if (cpu_desc == NULL) {
+    tla_printf("No CPU type selected!\n");
+    return;
+  }
+  while (count-- > 0) {
+    if (userInterrupt()) {
+      tla_printf("^C\n");
+      return;
+    }
+    addr &= 0xffff;
+    if (!mem_image_byte(addr, &op) || *(insn = mem_image_decode(&id, addr, op)) == '\0') {
+      tla_printf("%04lX  not in memory image\n", addr);
+      return;
+    }
+    for (n = 0; n < id.bytes_fetched; n++) {
+      sprintf(&bytes[3 * n], "%02X ", id.bytes[n]);
+    }
+    tla_printf("%04lX  %-*s %s\n", addr, 3 * INSN_DECODE_MAXBYTES, bytes, insn);
+    addr += id.bytes_fetched;
+  }
+}
+
+// Show which address ranges the memory image covers.
+void
+mem_image_show(void)
+{
+  uint32_t addr, start, total = 0;
+  uint8_t b;
+
+  for (addr = 0; addr <= 0xffff; addr++) {
+    if (!mem_image_byte(addr, &b)) {
+      continue;
+    }
+    for (start = addr; addr < 0xffff && mem_image_byte(addr + 1, &b); addr++) {
+      ;
+    }
+    if (total == 0) {
+      tla_printf("Memory image:\n");
+    }
+    tla_printf("  %04lX-%04lX\n", start, addr);
+    total += addr - start + 1;
+  }
+  if (total == 0) {
+    tla_printf("Memory image is empty.\n");
+  } else {
+    tla_printf("%lu bytes\n", total);
+  }
+}
+
+// Compare the reads in the sample buffer that fall within the memory
+// image against it; a mismatch means a bus error, contention or the
+// wrong image.
+void
+mem_image_verify(void)
+{
+  int first = (triggerPoint - pretrigger + samples) % samples;
+  int i, j, checked = 0, bad = 0;
+  bus_cycle_t bc;
+  uint8_t b;
+
+  if (cpu == cpu_none || samplesTaken == 0) {
+    tla_printf("No samples to verify.\n");
+    return;
+  }
+  for (j = 0; j < samples; j++) {
+    i = (first + j) % samples;
+    bc = bus_cycle(i);
+    if ((bc != bc_fetch && bc != bc_read && bc != bc_vector) ||
+        !mem_image_byte(address[i], &b)) {
+      continue;
+    }
+    checked++;
+    if (b != data[i]) {
+      if (bad++ < 10) {
+        tla_printf("Sample %d: %04lX read %02lX, image has %02X\n",
+            j, address[i], data[i], b);
+      }
+    }
+  }
+  tla_printf("%d reads checked against the memory image, %d mismatched.\n",
+      checked, bad);
+}
+
+//
+// BRANCH TRACE
+//
+// "trace go" captures a branch trace (see trace_samples()) and
+// "trace list" expands it back into the full instruction trace.
+//
+
+// Run the decoder over an instruction starting with op, followed by
+// b and then fill bytes.  Returns its length, or 0 if it didn't decode.
+static int
+trace_insn_length(uint8_t op, uint8_t b, uint8_t fill)
+{
+  struct insn_decode id;
+
+  insn_decode_init_uncached(&id, cpu_desc->decode);
+  insn_decode_begin(&id, 0, op);
+  while (id.state == ds_fetching) {
+    insn_decode_continue(&id, id.bytes_fetched == 1 ? b : fill);
+  }
+  if (id.state != ds_complete || id.bytes_fetched >= INSN_DECODE_MAXBYTES) {
+    return 0;
+  }
+  return id.bytes_fetched;
+}
+
+// Work out traceLength for the current CPU.  An opcode's length is only
+// used if the decoder gives the same answer whatever bytes follow it.
+void
+trace_lengths(void)
+{
+  int op, b, len;
+
+  if (traceLengthCpu == cpu) {
+    return;
+  }
+  for (op = 0; op < 256; op++) {
+    len = trace_insn_length(op, 0, 0);
+    for (b = 0; b < 256 && len != 0; b++) {
+      if (trace_insn_length(op, b, 0x00) != len ||
+          trace_insn_length(op, b, 0xff) != len) {
+        len = 0;
+      }
+    }
+    traceLength[op] = len;
+  }
+  traceLengthCpu = cpu;
+}
+
+void
+trace_go(void)
+{
+  int i;
+
+  if (!setup_triggers()) {
+    return;
+  }
+  trace_lengths();
+
+  tla_printf("Waiting for trigger...\n");
+
+  triggerPressed = false;
+  trig_reset();
+
+  setBusEnabled(true);
+  digitalWriteFast(CORE_LED0_PIN, HIGH); // Indicates waiting for trigger
+
+  samplesTaken = 0;
+
+  (*cpu_desc->trace)();
+  trigger_out_idle();
+
+  PERF_END(pf_capture, triggerCyccnt, samplesTaken);
+
+  setBusEnabled(false);
+
+  triggerMicros = micros() - (ARM_DWT_CYCCNT - triggerCyccnt) / (F_CPU_ACTUAL / 1000000);
+  triggerPoint = 0;
+
+  // The records aren't consecutive bus cycles, so the classifiers
+  // can't be used; the trace kernel already knows what each one is.
+  unscramble();
+  for (i = 0; i < samples; i++) {
+    set_bus_cycle(i, (recordInfo[i] & TRACE_FETCH) ? bc_fetch : bc_write);
+  }
+  list_reset();
+  captureMode = cm_trace;
+
+  tla_printf("Trace recorded (%d records, %lu bus cycles).\n", samplesTaken, traceCycles);
+  show_trigger_out_latency();
+}
+
+void
+trace_show(void)
+{
+  uint32_t skipped = 0;
+  int i;
+
+  if (captureMode != cm_trace) {
+    tla_printf("No trace recorded.\n");
+    return;
+  }
+  for (i = 0; i < samplesTaken; i++) {
+    skipped += (recordInfo[i] >> TRACE_SKIP_SHIFT) & TRACE_SKIP_MAX;
+  }
+  tla_printf("Trace: %d records covering %lu bus cycles", samplesTaken, traceCycles);
+  if (samplesTaken != 0) {
+    tla_printf(" (%lu cycles per record)", traceCycles / samplesTaken);
+  }
+  tla_printf("\n%lu instructions to reconstruct\n", skipped);
+}
+
+static void
+trace_line(Stream &stream, uint32_t addr, const char *cycle, uint32_t d,
+    const char *insn, const char *comment)
+{
+  char output[80];
+
+  // This printf format needs to be kept in sync with INSN_DECODE_MAXSTRING.
+  sprintf(output, "%04lX  %-2s  %02lX  %-28s  %-3s  %s",
+      addr, cycle, d, insn, "", comment);
+  stream.println(output);
+}
+
+// List the trace, reconstructing the skipped instructions from the
+// memory image.  Reconstructed fetches are shown as "f".
+void
+trace_list(Stream &stream)
+{
+  struct insn_decode id;
+  uint32_t pc = ~0U, last = ~0U, skipped, from;
+  char output[80], comment[30];
+  uint8_t op;
+  int i;
+
+  if (captureMode != cm_trace) {
+    tla_printf("No trace recorded.\n");
+    return;
+  }
+
+  for (i = 0; i < samplesTaken; i++) {
+    if (userInterrupt()) {
+      tla_printf("^C\n");
+      return;
+    }
+    skipped = (recordInfo[i] >> TRACE_SKIP_SHIFT) & TRACE_SKIP_MAX;
+    from = recordInfo[i] & TRACE_FROM_MASK;
+
+    for (; skipped != 0; skipped--) {
+      if (pc == ~0U || !mem_image_byte(pc, &op)) {
+        sprintf(comment, "(%lu not in memory image)", skipped);
+        sprintf(output, "....  %-2s  ..  %-28s  %-3s  last %04lX", "f", comment, "", from);
+        stream.println(output);
+        pc = last = from;
+        break;
+      }
+      trace_line(stream, pc, "f", op, mem_image_decode(&id, pc, op), "");
+      last = pc;
+      pc = traceLength[op] != 0 ? (pc + traceLength[op]) & 0xffff : ~0U;
+    }
+    if (last != from && i != 0) {
+      stream.println("!!!! Memory image doesn't match the trace");
+    }
+
+    if (recordInfo[i] & TRACE_FETCH) {
+      comment[0] = '\0';
+      if (address[i] != pc && i != 0) {
+        sprintf(comment, "from %04lX", from);
+      }
+      trace_line(stream, address[i], "F", data[i],
+          mem_image_decode(&id, address[i], data[i]), comment);
+      last = address[i];
+      pc = traceLength[data[i]] != 0 ? (address[i] + traceLength[data[i]]) & 0xffff : ~0U;
+    } else {
+      trace_line(stream, address[i], "W", data[i], "", "");
+    }
+  }
+}
+
+bool
+parseHexNumber(char *cp, uint32_t *valp)
+{
+  char *endptr = NULL;
+
+  if (cp[0] == '0' && (cp[1] == 'x' || cp[1] == 'X')) {
+    cp += 2;
+  } else if (cp[0] == '$') {
+    cp++;
+  } else {
+    size_t len = strlen(cp);
+    if (len != 0 && (cp[len - 1] == 'h' || cp[len - 1] == 'H')) {
+      cp[len - 1] = '\0';
+    }
+  }
+
+  int rv = strtol(cp, &endptr, 16);
+  if (endptr[0] != '\0') {
+    return false;
+  }
+  *valp = rv;
+  return true;
+}
+
+// Parse a number of the given width in bits that may have don't-care
+// digits: hex with X digits ("C0X0", "$C0X0", "C0X0h"), or binary of
+// the full width with x bits ("1xxxxxxx").  *maskp gets the bits that
+// must match.  Only a lower case "0x" prefix is taken as one, since
+// "0XX0" is a hex number with two don't-care digits.
+bool
+parseMaskedNumber(char *cp, int bits, uint32_t *valp, uint32_t *maskp)
+{
+  uint32_t width = (1U << bits) - 1;
+  uint32_t val = 0, mask = 0;
+  size_t len = strlen(cp);
+  bool hex = false;
+  int digits;
+
+  if (cp[0] == '0' && cp[1] == 'x' && cp[2] != '\0') {
+    cp += 2;
+    hex = true;
+  } else if (cp[0] == '$') {
+    cp++;
+    hex = true;
+  } else if (len != 0 && (cp[len - 1] == 'h' || cp[len - 1] == 'H')) {
+    cp[len - 1] = '\0';
+    hex = true;
+  }
+
+  if (!hex && strlen(cp) == (size_t)bits && strspn(cp, "01xX") == (size_t)bits) {
+    for (; *cp != '\0'; cp++) {
+      val <<= 1;
+      mask <<= 1;
+      if (*cp != 'x' && *cp != 'X') {
+        val |= *cp - '0';
+        mask |= 1;
+      }
+    }
+  } else {
+    for (digits = 0; *cp != '\0'; cp++, digits++) {
+      if (digits == 8) {
+        return false;
+      }
+      val <<= 4;
+      mask <<= 4;
+      if (*cp == 'x' || *cp == 'X') {
+        continue;
+      }
+      if (!isxdigit((unsigned char)*cp)) {
+        return false;
+      }
+      val |= isdigit((unsigned char)*cp) ? *cp - '0' : toupper(*cp) - 'A' + 10;
+      mask |= 0xf;
+    }
+    if (digits == 0 || (val & ~width) != 0) {
+      return false;
+    }
+    // Leading digits left out are zeros, not don't-cares.
+    if (digits < 8) {
+      mask |= ~((1U << (4 * digits)) - 1);
+    }
+    mask &= width;
+  }
+  *valp = val;
+  *maskp = mask;
+  return true;
+}
+
+bool
+parseDecimalNumber(char *cp, int *valp)
+{
+  char *endptr = NULL;
+
+  int rv = strtol(cp, &endptr, 10);
+  if (endptr[0] != '\0') {
+    return false;
+  }
+  *valp = rv;
+  return true;
+}
+
+bool
+parseAddress(char *cp, space_t space, uint32_t *addrp)
+{
+  uint32_t maxaddr = space == tr_io ? 0xff : 0xffff;
+  uint32_t val;
+
+  if (! parseHexNumber(cp, &val) || val > maxaddr) {
+    tla_printf("Invalid address.\n");
+    return false;
+  }
+  *addrp = val;
+  return true;
+}
+
+int
+stringMatch(const char *match, const char *user)
+{
+  int rv = 0;
+  size_t matchlen = strlen(match);
+  size_t userlen = strlen(user);
+
+  if (matchlen == userlen) {
+    if (strcmp(match, user) == 0) {
+      return (int)matchlen;
+    } else {
+      return 0;
+    }
+  } else if (matchlen < userlen) {
+    return 0;
+  }
+
+  // We now know that the user string is shorter than
+  // the match string.
+
+  for (rv = 0; *user != '\0'; rv++) {
+    if (*user++ != *match++) {
+      return 0;
+    }
+  }
+  return rv;
+}
+
+//
+// Command parsing and execution
+//
+#define MAX_ARGS  16
+int argc;
+char *argv[MAX_ARGS];
+
+
+#define CMDBUF_LEN  128
+char cmdbuf[CMDBUF_LEN];
+char saved_cmdbuf[CMDBUF_LEN];
+
+void
+help_cpu(void)
+{
+  int i;
+
+  tla_printf("usage: cpu        - show current CPU type\n");
+  tla_printf("       cpu <type> - set CPU type\n");
+  for (i = 0; cpu_descriptors[i].name != NULL; i++) {
+    tla_printf("%s%s%s\n",
+        i == 0 ? "\n" : "",
+        i == 0 ? "<type> must be: "
+               : "                ",
+        cpu_descriptors[i].name);
+  }
+}
+
+void
+command_cpu(void)
+{
+  if (argc == 1) {
+    show_cpu();
+    return;
+  } else if (argc != 2) {
+    help_cpu();
+    return;
+  }
+
+  int i;
+  for (i = 0; cpu_descriptors[i].name != NULL; i++) {
+    if (strcasecmp(cpu_descriptors[i].name, argv[1]) == 0) {
+      set_cpu(cpu_descriptors[i].type);
+      if (triggerMode != tr_none && triggerMode != tr_manual) {
+        triggerMode = tr_none;
+        triggerThenCount = 0;
+        triggerCount = 1;
+        tla_printf("WARNING: trigger mode reset\n");
+      }
+      return;
+    }
+  }
+  tla_printf("Invalid CPU type: %s\n", argv[1]);
+}
+
+void
+help_samples(void)
+{
+  tla_printf("usage: samples         - show current sample count\n");
+  tla_printf("       samples <count> - set sample count\n");
+  tla_printf("\n<count> must be between 1 and %d.\n", BUFFSIZE);
+}
+
+void
+command_samples(void)
+{
+  if (argc == 1) {
+    show_samples();
+    return;
+  } else if (argc != 2) {
+    help_samples();
+    return;
+  }
+
+  int c;
+  c = (int) strtol(argv[1], NULL, 10);
+  if (c < 1 || c > BUFFSIZE) {
+    tla_printf("Invalid sample count.\n");
+    help_samples();
+    return;
+  }
+
+  samples = c;
+  if (pretrigger > c) {
+    pretrigger = 0;
+    tla_printf("WARNING: pretrigger sample count reset to 0.\n");
+  }
+  memset(control, 0, sizeof(control)); // Clear existing data
+  memset(address, 0, sizeof(address));
+  memset(data, 0, sizeof(data));
+  memset(cycles, 0, sizeof(cycles));
+  list_reset();
+  captureMode = cm_samples;
+}
+
+void
+help_pretrigger(void)
+{
+  tla_printf("usage: pretrigger         - show current pretrigger sample count\n");
+  tla_printf("       pretrigger <count> - set pretrigger sample count\n");
+  tla_printf("\n<count> must be between 0 and the numnber of samples (currently %d).\n",
+      samples);
+  tla_printf("\nType \"help samples\" for more information.\n");
+}
+
+void
+command_pretrigger(void)
+{
+  if (argc == 1) {
+    show_pretrigger();
+    return;
+  } else if (argc != 2) {
+    help_pretrigger();
+    return;
+  }
+
+  int c;
+  c = (int) strtol(argv[1], NULL, 10);
+  if (c < 0 || c > samples) {
+    tla_printf("Invalid pretrigger samples count.\n");
+    help_pretrigger();
+    return;
+  }
+
+  if (triggerMode == tr_none) {
+    tla_printf("Cannot have pretrigger samples with trigger mode 'none'.\n");
+    pretrigger = 0;
+    return;
+  }
+
+  pretrigger = c;
+  list_reset();
+}
+
+// Signal triggers ("reset", "irq", etc.) are only offered if the
+// current CPU has a trigger signal by that name.
+const struct {
+  const char *typestr;
+  trigger_t   type;
+  bool        signal;
+} triggertab[] = {
+  { "address",  tr_address },
+  { "data",     tr_data },
+  { "reset",    tr_reset,     true },
+  { "irq",      tr_irq,       true },
+  { "int",      tr_irq,       true },
+  { "firq",     tr_firq,      true },
+  { "nmi",      tr_nmi,       true },
+  { "change",   tr_change },
+  { "illegal",  tr_illegal },
+  { "manual",   tr_manual },
+  { "none",     tr_none },
+  { NULL },
+};
+
+bool
+trigger_signal_valid(int i)
+{
+  const char *name;
+
+  if (triggertab[i].type == tr_illegal) {
+    return illegal_trigger_valid();
+  }
+  if (! triggertab[i].signal) {
+    return true;
+  }
+  if (trigger_signal(triggertab[i].type) == 0) {
+    return false;
+  }
+  name = trigger_signal_name(triggertab[i].type);
+  if (*name == '/') {
+    name++;
+  }
+  return strcasecmp(name, triggertab[i].typestr) == 0;
+}
+
+void
+help_trigger(void)
+{
+  int pad = cpu_has_iospace(cpu) ? 38 : 33;
+  int i;
+
+  tla_printf("usage: trigger %s                                  - show current trigger\n",
+      cpu_has_iospace(cpu) ? "     " : "");
+  tla_printf("       trigger %saddress <addr> [r|w]              - trigger on address\n",
+      cpu_has_iospace(cpu) ? "[io] " : "");
+  tla_printf("       trigger %sdata <value> [r|w]                - trigger on data\n",
+      cpu_has_iospace(cpu) ? "[io] " : "");
+  tla_printf("       trigger %saddress <addr> data <value> [r|w] - trigger on address and data\n",
+      cpu_has_iospace(cpu) ? "[io] " : "");
+  for (i = 0; triggertab[i].typestr != NULL; i++) {
+    if (triggertab[i].signal && trigger_signal_valid(i)) {
+      char usage[16];
+      snprintf(usage, sizeof(usage), "%s 0|1", triggertab[i].typestr);
+      tla_printf("%s       trigger %-*s - trigger on %s level\n",
+          triggertab[i].type == tr_reset ? "\n" : "",
+          pad, usage, trigger_signal_name(triggertab[i].type));
+    }
+  }
+
+  tla_printf("\n       trigger %-*s - trigger on a write that changes memory\n",
+      pad, "change <addr>");
+  tla_printf("       trigger %-*s - trigger on a write of anything else\n",
+      pad, "change <addr> data <value>");
+  if (illegal_trigger_valid()) {
+    tla_printf("       trigger %-*s - trigger on fetching an undefined opcode\n",
+        pad, "illegal");
+  }
+
+  tla_printf("\n       trigger %-*s - trigger on the <n>th match\n", pad, "count <n>");
+  tla_printf("       trigger %-*s - then wait for another match\n", pad, "then <trigger>");
+  tla_printf("       trigger %-*s - show the compiled trigger program\n", pad, "program");
+  tla_printf("       trigger %-*s - run the trigger over the sample data\n", pad, "test");
+
+  tla_printf("\n       trigger %-*s - assert pin %d on trigger\n",
+      pad, "out high|low|off", TRIGGER_OUT_PIN);
+
+  if (cpu_has_iospace(cpu)) {
+    tla_printf("\n<addr> must be between 0 and FF for I/O space and 0 and FFFF for memory space.\n");
+  } else {
+    tla_printf("\n<addr> must be between 0 and FFFF.\n");
+  }
+  tla_printf("<data> must be between 0 and FF.\n");
+  tla_printf("Either may have X digits that match anything (e.g. C0X0), or be given in\n");
+  tla_printf("binary with x bits (e.g. 1xxxxxxx).  \"mask <m>\" after a value only\n");
+  tla_printf("matches the bits set in <m>.\n");
+  tla_printf("\n\"change\" remembers the last value written to each address during the\n");
+  tla_printf("capture, and triggers on a write of a different one.  The first write to\n");
+  tla_printf("each address only sets the value to compare with.\n");
+  tla_printf("\n\"then\" adds a stage (up to %d) that is only looked for once the\n", TRIG_STAGES);
+  tla_printf("stages before it have matched, and \"count\" applies to the last stage.\n");
+  tla_printf("Setting a new trigger starts again from one stage.\n");
+  tla_printf("\nTrigger out is asserted from the capture loop as soon as the trigger\n");
+  tla_printf("matches, and stays asserted until the capture is done.  \"go\" reports\n");
+  tla_printf("the time from the trigger being detected to the pin changing.  That\n");
+  tla_printf("leaves out the time to sample and match the bus cycle, so the true\n");
+  tla_printf("latency is longer; check it with a scope if it matters.\n");
+}
+
+// Parse a match condition from argv[argidx] onwards (e.g. "io address
+// 42 w" or "irq 0") into *ms, which holds the previous settings on entry.
+// Returns false if the arguments are invalid; the caller is expected to
+// follow up with its usage message.
+bool
+parse_match(int argidx, struct match_spec *ms)
+{
+  int i, modeidx;
+  bool iomodifier = false;
+
+  // First, the trigger type.
+ mode_again:
+  if (argidx >= argc) {
+    return false;
+  }
+  for (modeidx = -1, i = 0; triggertab[i].typestr != NULL; i++) {
+    // Special case for CPUs with I/O space -- check for "io" modifier.
+    if (cpu_has_iospace(cpu) && strcmp(argv[argidx], "io") == 0) {
+      if (iomodifier) {
+        return false;
+      }
+      iomodifier = true;
+      argidx++;
+      goto mode_again;
+    }
+    if (! trigger_signal_valid(i)) {
+      continue;
+    }
+    if (stringMatch(triggertab[i].typestr, argv[argidx]) > 0) {
+      if (modeidx != -1) {
+        tla_printf("Ambiguous trigger mode.\n");
+        return false;
+      }
+      modeidx = i;
+    }
+  }
+
+  trigger_t new_triggerMode;
+  if (modeidx == -1) {
+    // If we got the iomodifier, allow it as an alias for "address".
+    if (iomodifier) {
+      new_triggerMode = tr_address;
+      // Walk back the argument cursor to point at "io".
+      argidx--;
+    } else {
+      tla_printf("Invalid trigger mode.\n");
+      return false;
+    }
+  } else {
+    new_triggerMode = triggertab[modeidx].type;
+  }
+
+  cycle_t new_triggerCycle = ms->cycle;
+  space_t new_triggerSpace = ms->space;
+  bool new_triggerLevel = ms->level;
+  uint32_t new_triggerAddress = ms->address;
+  uint32_t new_triggerAddressMask = ms->address_mask;
+  uint32_t new_triggerData = ms->data;
+  uint32_t new_triggerDataMask = ms->data_mask;
+
+  argidx++;
+
+  if (iomodifier && (new_triggerMode != tr_address &&
+                     new_triggerMode != tr_data)) {
+    tla_printf("Invalid trigger mode for \"io\" modifier.\n");
+    return false;
+  }
+
+  switch (new_triggerMode) {
+    case tr_none:
+    case tr_manual:
+    case tr_illegal:
+      if (argidx != argc) {
+        return false;
+      }
+      break;
+
+    case tr_address:
+    case tr_data: {
+      //
+      // We accept lines like this:
+      //
+      //  t io addr 0x42 data 0xff
+      //  t data $a5 address $cafe w
+      //  t a FFFFh r
       //
       // We arrive with our argument index pointing:
       //
@@ -1725,232 +5461,1215 @@ command_trigger(void)
       bool got_address = false;
       bool got_data = false;
       bool got_cycle = false;
+      uint32_t *last_mask = NULL;
+      uint32_t mask;
+
+      new_triggerSpace = iomodifier ? tr_io : tr_mem;
+      new_triggerCycle = tr_either;
+
+      // Must at least have first numeric argument.
+      if (argidx == argc) {
+        return false;
+      }
+      argidx--;
+
+      while (argidx != argc) {
+        if (!got_address && (stringMatch("address", argv[argidx]) > 0 ||
+            (iomodifier && strcmp("io", argv[argidx]) == 0))) {
+          got_address = true;
+          argidx++;
+          if (argidx == argc) {
+            return false;
+          }
+          if (! parseMaskedNumber(argv[argidx++], new_triggerSpace == tr_io ? 8 : 16,
+                                  &new_triggerAddress, &new_triggerAddressMask)) {
+            tla_printf("Invalid address.\n");
+            return false;
+          }
+          last_mask = &new_triggerAddressMask;
+          continue;
+        }
+        if (!got_data && stringMatch("data", argv[argidx]) > 0) {
+          got_data = true;
+          argidx++;
+          if (argidx == argc) {
+            return false;
+          }
+          if (! parseMaskedNumber(argv[argidx++], 8, &new_triggerData, &new_triggerDataMask)) {
+            tla_printf("Invalid data value.\n");
+            return false;
+          }
+          last_mask = &new_triggerDataMask;
+          continue;
+        }
+        // "mask <m>" narrows the address or data value before it.
+        if (last_mask != NULL && stringMatch("mask", argv[argidx]) > 0) {
+          argidx++;
+          if (argidx == argc || ! parseHexNumber(argv[argidx++], &mask)) {
+            return false;
+          }
+          *last_mask &= mask;
+          last_mask = NULL;
+          continue;
+        }
+        if (!got_cycle) {
+          if (stringMatch("read", argv[argidx]) > 0) {
+            got_cycle = true;
+            new_triggerCycle = tr_read;
+            argidx++;
+            continue;
+          } else if (stringMatch("write", argv[argidx]) > 0) {
+            got_cycle = true;
+            new_triggerCycle = tr_write;
+            argidx++;
+            continue;
+          }
+        }
+        return false;
+      }
+      if (got_data && got_address) {
+        new_triggerMode = tr_addr_data;
+      }
+      break;
+    }
+
+    case tr_reset:
+    case tr_irq:
+    case tr_firq:
+    case tr_nmi:
+      // All the rest need a level indicator, and only a level indicator.
+      if (argidx + 1 != argc) {
+        tla_printf("Missing level indicator.\n");
+        return false;
+      }
+      if (strcmp(argv[argidx], "1") == 0 ||
+          stringMatch("high", argv[argidx]) > 0) {
+        new_triggerLevel = true;
+      } else if (strcmp(argv[argidx], "0") == 0 ||
+                 stringMatch("low", argv[argidx]) > 0) {
+        new_triggerLevel = false;
+      } else {
+        tla_printf("Invalid level indicator.\n");
+        return false;
+      }
+      break;
+
+    case tr_change:
+      // change <addr> [data <value>]
+      if (argidx == argc ||
+          ! parseMaskedNumber(argv[argidx++], 16, &new_triggerAddress,
+                              &new_triggerAddressMask)) {
+        tla_printf("Invalid address.\n");
+        return false;
+      }
+      new_triggerDataMask = 0;
+      if (argidx != argc) {
+        if (argidx + 2 != argc || stringMatch("data", argv[argidx]) <= 0) {
+          return false;
+        }
+        if (! parseMaskedNumber(argv[argidx + 1], 8, &new_triggerData,
+                                &new_triggerDataMask) || new_triggerDataMask == 0) {
+          tla_printf("Invalid data value.\n");
+          return false;
+        }
+      }
+      new_triggerSpace = tr_mem;
+      new_triggerCycle = tr_write;
+      break;
+
+    case tr_addr_data:
+    default:
+      tla_printf("*** INTERNAL ERROR: unxpected trigger mode %d ***\n", (int)new_triggerMode);
+      return false;
+  }
+
+  // Everthing thing is good -- commit the changes.
+  ms->mode = new_triggerMode;
+  ms->cycle = new_triggerCycle;
+  ms->space = new_triggerSpace;
+  ms->level = new_triggerLevel;
+  ms->address = new_triggerAddress & new_triggerAddressMask;
+  ms->address_mask = new_triggerAddressMask;
+  ms->data = new_triggerData & new_triggerDataMask;
+  ms->data_mask = new_triggerDataMask;
+  return true;
+}
+
+void
+command_trigger(void)
+{
+  struct match_spec ms;
+
+  if (argc == 1) {
+    show_trigger();
+    return;
+  }
+  if (argc == 3 && stringMatch("out", argv[1]) > 0) {
+    if (stringMatch("high", argv[2]) > 0) {
+      triggerOut = to_high;
+    } else if (stringMatch("low", argv[2]) > 0) {
+      triggerOut = to_low;
+    } else if (stringMatch("off", argv[2]) > 0) {
+      triggerOut = to_off;
+    } else {
+      help_trigger();
+      return;
+    }
+    trigger_out_idle();
+    return;
+  }
+  // "c" alone could be "change".
+  if (argc == 3 && stringMatch("count", argv[1]) > 1) {
+    int count;
+
+    if (!parseDecimalNumber(argv[2], &count) || count < 1) {
+      help_trigger();
+      return;
+    }
+    if (triggerThenCount == 0) {
+      triggerCount = count;
+    } else {
+      triggerThen[triggerThenCount - 1].count = count;
+    }
+    return;
+  }
+  if (argc == 2 && stringMatch("program", argv[1]) > 0) {
+    trig_list();
+    return;
+  }
+  if (argc == 2 && stringMatch("test", argv[1]) > 0) {
+    trig_test();
+    return;
+  }
+  if (argc >= 3 && stringMatch("then", argv[1]) > 0) {
+    if (triggerThenCount == TRIG_STAGES - 1) {
+      tla_printf("No more than %d trigger stages.\n", TRIG_STAGES);
+      return;
+    }
+    if (triggerMode == tr_none || triggerMode == tr_manual) {
+      tla_printf("Set a bus trigger before adding stages.\n");
+      return;
+    }
+    if (triggerThenCount == 0) {
+      trigger_spec(&ms);
+    } else {
+      ms = triggerThen[triggerThenCount - 1].spec;
+    }
+    if (!parse_match(2, &ms)) {
+      help_trigger();
+      return;
+    }
+    if (ms.mode == tr_none || ms.mode == tr_manual) {
+      tla_printf("Only a bus trigger can be a later stage.\n");
+      return;
+    }
+    triggerThen[triggerThenCount].spec = ms;
+    triggerThen[triggerThenCount++].count = 1;
+    return;
+  }
+
+  trigger_spec(&ms);
+  if (!parse_match(1, &ms)) {
+    help_trigger();
+    return;
+  }
+  triggerThenCount = 0;
+  triggerCount = 1;
+  if (ms.mode == tr_none && pretrigger != 0) {
+    tla_printf("Warning: pretrigger reset to 0.\n");
+    pretrigger = 0;
+  }
+
+  triggerMode = ms.mode;
+  triggerCycle = ms.cycle;
+  triggerSpace = ms.space;
+  triggerLevel = ms.level;
+  triggerAddress = ms.address;
+  triggerAddressMask = ms.address_mask;
+  triggerData = ms.data;
+  triggerDataMask = ms.data_mask;
+}
+
+void
+help_go(void)
+{
+  tla_printf("usage: go           - start the analyzer\n");
+  tla_printf("       go writes    - record only write cycles\n");
+  tla_printf("       go compress  - record repeated bus cycles once\n");
+  tla_printf("\nA write log stores each write with the number of bus cycles since\n");
+  tla_printf("the previous one, so the samples and pretrigger counts are counts of\n");
+  tla_printf("writes rather than bus cycles.\n");
+  tla_printf("\nA compressed capture stores a bus cycle that repeats the one before it,\n");
+  tla_printf("or any bus cycle while the CPU is halted (e.g. WAI, SYNC or HALT), as a\n");
+  tla_printf("repeat count on the record before it, so the buffer reaches back past\n");
+  tla_printf("long idle periods.  The samples and pretrigger counts are counts of\n");
+  tla_printf("records.\n");
+}
+
+void
+command_go(void)
+{
+  if (argc == 1) {
+    go(cm_samples);
+    return;
+  }
+  if (argc == 2 && stringMatch("writes", argv[1]) > 0) {
+    go(cm_writes);
+    return;
+  }
+  if (argc == 2 && stringMatch("compress", argv[1]) > 0) {
+    go(cm_compressed);
+    return;
+  }
+  help_go();
+}
 
-      new_triggerSpace = iomodifier ? tr_io : tr_mem;
-      new_triggerCycle = tr_either;
+void
+help_list(void)
+{
+  tla_printf("usage: list                  - list a page of samples around the trigger\n");
+  tla_printf("       list all              - list all samples\n");
+  tla_printf("       list <start> [<end>]  - list samples <start> through <end>\n");
+  tla_printf("\n<start> must be between 0 and the number of samples - 1 (curretly %d).\n",
+      samples - 1);
+  tla_printf("<end> must be between <start> and the number of samples - 1.\n");
+  tla_printf("\nUse \"next\", \"prev\" and \"goto\" to move around the listing, and\n");
+  tla_printf("Ctrl-C to stop a listing early.\n");
+  tla_printf("\nType \"help samples\" for more information.\n");
+}
 
-      // Must at least have first numeric argument.
-      if (argidx == argc) {
-        help_trigger();
-        return;
+void
+command_list(void)
+{
+  int start = 0;
+  int end = samples - 1;
+  int n;
+
+  if (argc == 1) {
+    list_page_around(list_trigger_sample());
+    return;
+  }
+  if (argc == 2 && stringMatch("all", argv[1]) > 0) {
+    list_show(start, end);
+    return;
+  }
+  if (argc > 1) {
+    if (!parseDecimalNumber(argv[1], &n)) {
+      tla_printf("Invalid <start>.\n");
+      help_list();
+      return;
+    }
+    start = n;
+  }
+  if (argc > 2) {
+    if (!parseDecimalNumber(argv[2], &n)) {
+      tla_printf("Invalid <end>.\n");
+      help_list();
+      return;
+    }
+    end = n;
+  }
+  if (argc > 3) {
+    help_list();
+    return;
+  }
+  if (start < 0 || start >= samples || end < start || end >= samples) {
+    tla_printf("Invalid samples range: must be between 0 and %d.\n", samples - 1);
+    return;
+  }
+  list_show(start, end);
+}
+
+void
+help_next(void)
+{
+  tla_printf("usage: next - list the next page of samples\n");
+}
+
+void
+command_next(void)
+{
+  if (argc != 1) {
+    help_next();
+    return;
+  }
+  if (listEnd < 0) {
+    list_page_around(list_trigger_sample());
+  } else if (listEnd >= samples - 1) {
+    tla_printf("End of samples.\n");
+  } else {
+    list_page(listEnd + 1);
+  }
+}
+
+void
+help_prev(void)
+{
+  tla_printf("usage: prev - list the previous page of samples\n");
+}
+
+void
+command_prev(void)
+{
+  if (argc != 1) {
+    help_prev();
+    return;
+  }
+  if (listStart < 0) {
+    list_page_around(list_trigger_sample());
+  } else if (listStart == 0) {
+    tla_printf("Start of samples.\n");
+  } else {
+    list_page(listStart - LIST_PAGE_LINES);
+  }
+}
+
+void
+help_goto(void)
+{
+  tla_printf("usage: goto trigger      - list the page around the trigger point\n");
+  tla_printf("       goto sample <n>   - list the page around sample <n>\n");
+  tla_printf("       goto addr <addr>  - list the page around the next sample at <addr>\n");
+  tla_printf("\nRepeating \"goto addr\" finds successive samples at <addr>.\n");
+}
+
+void
+command_goto(void)
+{
+  int first = (triggerPoint - pretrigger + samples) % samples;
+  uint32_t addr;
+  int j, n = 0;
+
+  if (argc == 2 && stringMatch("trigger", argv[1]) > 0) {
+    listMark = list_trigger_sample();
+  } else if (argc == 3 && stringMatch("sample", argv[1]) > 0) {
+    if (!parseDecimalNumber(argv[2], &n) || n < 0 || n >= samples) {
+      tla_printf("Invalid sample: must be between 0 and %d.\n", samples - 1);
+      return;
+    }
+    listMark = n;
+  } else if (argc == 3 && stringMatch("addr", argv[1]) > 0) {
+    if (!parseAddress(argv[2], tr_mem, &addr)) {
+      help_goto();
+      return;
+    }
+    // Search forward from the last goto target, wrapping around.
+    for (j = 0; j < samples; j++) {
+      n = (listMark + 1 + j) % samples;
+      if (address[(first + n) % samples] == addr) {
+        break;
       }
-      argidx--;
+    }
+    if (j == samples) {
+      tla_printf("Address not found in sample data.\n");
+      return;
+    }
+    listMark = n;
+  } else {
+    help_goto();
+    return;
+  }
+  list_page_around(listMark);
+}
 
-      while (argidx != argc) {
-        if (!got_address && (stringMatch("address", argv[argidx]) > 0 ||
-            (iomodifier && strcmp("io", argv[argidx]) == 0))) {
-          got_address = true;
-          argidx++;
-          if (argidx == argc) {
-            help_trigger();
-            return;
-          }
-          if (! parseAddress(argv[argidx++], new_triggerSpace, &new_triggerAddress)) {
-            help_trigger();
-            return;
-          }
-          continue;
-        }
-        if (!got_data && stringMatch("data", argv[argidx]) > 0) {
-          got_data = true;
-          argidx++;
-          if (argidx == argc) {
-            help_trigger();
-            return;
-          }
-          if (! parseHexNumber(argv[argidx++], &new_triggerData)) {
-            help_trigger();
-            return;
-          }
-          if (new_triggerData > 0xff) {
-            tla_printf("Invalid data value.\n");
-            help_trigger();
-            return;
-          }
-          continue;
-        }
-        if (!got_cycle) {
-          if (stringMatch("read", argv[argidx]) > 0) {
-            got_cycle = true;
-            new_triggerCycle = tr_read;
-            argidx++;
-            continue;
-          } else if (stringMatch("write", argv[argidx]) > 0) {
-            got_cycle = true;
-            new_triggerCycle = tr_write;
-            argidx++;
-            continue;
-          }
-        }
-        help_trigger();
+void
+help_export(void)
+{
+  tla_printf("usage: export                     - export samples in CSV format\n");
+  tla_printf("       export columns             - show the exported columns\n");
+  tla_printf("       export columns <col> ...   - select the exported columns\n");
+  tla_printf("       export columns default     - export the default columns\n");
+  tla_printf("\n<col> may be a comma-separated list.  Columns are exported in the order given.\n");
+  tla_printf("<col> must be one of:\n");
+  tla_printf("  index, trigger, address, data, cycle, instruction, repeat\n");
+  tla_printf("    (or any prefix that only one of them has, e.g. ins or rep)\n");
+  tla_printf("  any control signal name for the current CPU (e.g. /RESET or reset)\n");
+  tla_printf("  all - every control signal\n");
+}
+
+void
+show_export_columns(void)
+{
+  struct export_column defcols[MAX_EXPORT_COLUMNS];
+  const struct export_column *cols = exportColumns;
+  int ncols = exportColumnCount;
+  int c;
+
+  if (ncols == 0) {
+    ncols = export_default_columns(defcols);
+    cols = defcols;
+  }
+  tla_printf("Export columns%s: ", exportColumnCount == 0 ? " (default)" : "");
+  for (c = 0; c < ncols; c++) {
+    tla_printf("%s%s", c ? "," : "", export_column_name(&cols[c]));
+  }
+  tla_printf("\n");
+}
+
+bool
+add_export_column(struct export_column *cols, int *ncolsp, export_col_t type,
+    const struct cpu_signal *sig)
+{
+  int c;
+
+  if (*ncolsp == MAX_EXPORT_COLUMNS) {
+    tla_printf("Too many columns.\n");
+    return false;
+  }
+  for (c = 0; c < *ncolsp; c++) {
+    if (cols[c].type == type && cols[c].sig == sig) {
+      tla_printf("Duplicate column: %s\n", export_column_name(&cols[c]));
+      return false;
+    }
+  }
+  cols[*ncolsp].type = type;
+  cols[*ncolsp].sig = sig;
+  (*ncolsp)++;
+  return true;
+}
+
+bool
+parse_export_column(char *cp, struct export_column *cols, int *ncolsp)
+{
+  const struct cpu_signal *sig;
+  const char *name;
+  size_t len = strlen(cp);
+  int i, field = -1, matches = 0;
+
+  // A field name may be shortened to any prefix that only it has.
+  for (i = 0; export_fields[i].name != NULL; i++) {
+    if (strncasecmp(export_fields[i].name, cp, len) == 0) {
+      field = i;
+      if (export_fields[i].name[len] == '\0') {
+        matches = 1;
+        break;
+      }
+      matches++;
+    }
+  }
+  if (matches > 1) {
+    tla_printf("Ambiguous column: %s\n", cp);
+    return false;
+  }
+  if (matches == 1) {
+    return add_export_column(cols, ncolsp, export_fields[field].type, NULL);
+  }
+  if (strcasecmp(cp, "all") == 0) {
+    for (sig = cpu_desc->signals; sig->name != NULL; sig++) {
+      if (! add_export_column(cols, ncolsp, ec_signal, sig)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  for (sig = cpu_desc->signals; sig->name != NULL; sig++) {
+    name = sig->name;
+    if (strcasecmp(name, cp) == 0 ||
+        (name[0] == '/' && strcasecmp(name + 1, cp) == 0)) {
+      return add_export_column(cols, ncolsp, ec_signal, sig);
+    }
+  }
+  tla_printf("Unknown column: %s\n", cp);
+  return false;
+}
+
+void
+command_export_columns(void)
+{
+  struct export_column cols[MAX_EXPORT_COLUMNS];
+  int ncols = 0;
+  char *cp, *next;
+  int i;
+
+  if (cpu_desc == NULL) {
+    tla_printf("No CPU type selected!\n");
+    return;
+  }
+  if (argc == 2) {
+    show_export_columns();
+    return;
+  }
+  if (argc == 3 && strcasecmp(argv[2], "default") == 0) {
+    exportColumnCount = 0;
+    return;
+  }
+
+  for (i = 2; i < argc; i++) {
+    for (cp = argv[i]; cp != NULL; cp = next) {
+      if ((next = strchr(cp, ',')) != NULL) {
+        *next++ = '\0';
+      }
+      // A trailing comma is allowed, for "index, data".
+      if (*cp == '\0' && next == NULL) {
+        continue;
+      }
+      if (*cp == '\0') {
+        tla_printf("Empty column name.\n");
+        help_export();
         return;
       }
-      if (got_data && got_address) {
-        new_triggerMode = tr_addr_data;
+      if (! parse_export_column(cp, cols, &ncols)) {
+        help_export();
+        return;
+      }
+    }
+  }
+  memcpy(exportColumns, cols, sizeof(cols[0]) * ncols);
+  exportColumnCount = ncols;
+}
+
+void
+command_export(void)
+{
+  if (argc >= 2 && stringMatch("columns", argv[1]) > 0) {
+    command_export_columns();
+    return;
+  }
+  if (argc != 1) {
+    help_export();
+    return;
+  }
+  exportCSV(Serial, samplesTaken);
+}
+
+void
+help_write(void)
+{
+  tla_printf("usage: write - write data to SD card\n");
+  tla_printf("\nThe file \"analyzer.csv\" will contain the sample data in CSV format.\n");
+  tla_printf("The file \"analyzer.txt\" will contain the sample data in \"list\" format.\n");
+}
+
+void
+command_write(void)
+{
+  if (argc != 1) {
+    help_write();
+    return;
+  }
+  writeSD();
+}
+
+void
+help_decode(void)
+{
+  tla_printf("usage: decode <addr>          - decode a single instruction at <addr>\n");
+  tla_printf("       decode <addr> <count>  - disassemble <count> instructions from the\n");
+  tla_printf("                                memory image starting at <addr>\n");
+  tla_printf("       decode cache           - show the decode cache hit rate\n");
+  tla_printf("\n<addr> must be between 0 and FFFF and must be present in the sample data\n");
+  tla_printf("or the memory image.\n");
+}
+
+void
+command_decode(void)
+{
+  uint32_t pc, total;
+  int count;
+
+  if (argc == 2 && stringMatch("cache", argv[1]) > 0) {
+    total = insn_decode_cache_hits + insn_decode_cache_misses;
+    tla_printf("Decode cache: %lu hits, %lu misses", insn_decode_cache_hits,
+        insn_decode_cache_misses);
+    if (total != 0) {
+      tla_printf(" (%.1f%% hit rate)", 100.0 * insn_decode_cache_hits / total);
+    }
+    tla_printf("\n");
+    return;
+  }
+  if (argc == 3 && parseAddress(argv[1], tr_mem, &pc) &&
+      parseDecimalNumber(argv[2], &count) && count > 0) {
+    mem_image_disassemble(pc, count);
+    return;
+  }
+  if (argc != 2) {
+    help_decode();
+    return;
+  }
+  if (parseAddress(argv[1], tr_mem, &pc)) {
+    disassemble_one(pc);
+  } else {
+    help_decode();
+  }
+}
+
+const struct {
+  const char      *name;
+  soak_archive_t  what;
+} soakarchivetab[] = {
+  { "none",       sa_none },
+  { "all",        sa_all },
+  { "anomaly",    sa_anomaly },
+  { "coverage",   sa_coverage },
+  { "latency",    sa_latency },
+  { NULL },
+};
+
+void
+help_soak(void)
+{
+  tla_printf("usage: soak                  - capture repeatedly until Ctrl-C\n");
+  tla_printf("       soak <count>          - capture <count> times\n");
+  tla_printf("       soak status           - show the soak statistics\n");
+  tla_printf("       soak reset            - clear the soak statistics\n");
+  tla_printf("       soak archive <what>   - choose which captures to save to SD\n");
+  tla_printf("\nEach capture uses the current trigger settings and is folded into the\n");
+  tla_printf("statistics: trigger intervals, interrupt latency, anomalies (resets and\n");
+  tla_printf("interrupt requests withdrawn before acknowledge) and address coverage.\n");
+  tla_printf("The summary and coverage bitmap are kept in soak.txt and soakcov.bin.\n");
+  tla_printf("\n<what> must be one of:\n");
+  tla_printf("  none, all, anomaly, coverage (new addresses touched),\n");
+  tla_printf("  latency <cycles> (an interrupt took at least <cycles> to acknowledge)\n");
+}
+
+void
+command_soak(void)
+{
+  int i, n;
+
+  if (argc >= 2 && stringMatch("status", argv[1]) > 0) {
+    soak_summary(Serial);
+    return;
+  }
+  if (argc == 2 && stringMatch("reset", argv[1]) > 0) {
+    soak_reset();
+    return;
+  }
+  if (argc >= 2 && stringMatch("archive", argv[1]) > 0) {
+    if (argc == 2) {
+      tla_printf("Archiving: %s", soakarchivetab[soakArchive].name);
+      if (soakArchive == sa_latency) {
+        tla_printf(" >= %d cycles", soakLatencyLimit);
       }
-      break;
+      tla_printf("\n");
+      return;
     }
-
-    case tr_reset:
-    case tr_irq:
-    case tr_firq:
-    case tr_nmi:
-      // All the rest need a level indicator, and only a level indicator.
-      if (argidx + 1 != argc) {
-        tla_printf("Missing level indicator.\n");
-        help_trigger();
-        return;
+    for (i = 0; soakarchivetab[i].name != NULL; i++) {
+      if (stringMatch(soakarchivetab[i].name, argv[2]) > 0) {
+        break;
       }
-      if (strcmp(argv[argidx], "1") == 0 ||
-          stringMatch("high", argv[argidx]) > 0) {
-        new_triggerLevel = true;
-      } else if (strcmp(argv[argidx], "0") == 0 ||
-                 stringMatch("low", argv[argidx]) > 0) {
-        new_triggerLevel = false;
-      } else {
-        tla_printf("Invalid level indicator.\n");
-        help_trigger();
+    }
+    if (soakarchivetab[i].name == NULL ||
+        (soakarchivetab[i].what == sa_latency) != (argc == 4) || argc > 4) {
+      help_soak();
+      return;
+    }
+    if (argc == 4) {
+      if (!parseDecimalNumber(argv[3], &n) || n < 0) {
+        tla_printf("Invalid <cycles>.\n");
         return;
       }
-      break;
+      soakLatencyLimit = n;
+    }
+    soakArchive = soakarchivetab[i].what;
+    return;
+  }
 
-    case tr_addr_data:
-    default:
-      tla_printf("*** INTERNAL ERROR: unxpected trigger mode %d ***\n", (int)new_triggerMode);
+  n = 0;
+  if (argc == 2) {
+    if (!parseDecimalNumber(argv[1], &n) || n < 1) {
+      help_soak();
       return;
+    }
+  } else if (argc != 1) {
+    help_soak();
+    return;
   }
-
-  // Everthing thing is good -- commit the changes.
-  triggerMode = new_triggerMode;
-  triggerCycle = new_triggerCycle;
-  triggerSpace = new_triggerSpace;
-  triggerLevel = new_triggerLevel;
-  triggerAddress = new_triggerAddress;
-  triggerData = new_triggerData;
+  if (cpu_desc == NULL) {
+    tla_printf("No CPU type selected!\n");
+    return;
+  }
+  soak_run(n);
 }
 
 void
-help_go(void)
+help_monitor(void)
 {
-  tla_printf("usage: go - start the analyzer\n");
+  tla_printf("usage: monitor - show the instructions executed, live, until Ctrl-C\n");
+  tla_printf("\nThe analyzer captures windows of <samples> bus cycles using the current\n");
+  tla_printf("trigger settings, and lists the instructions in each.  When the console\n");
+  tla_printf("can't keep up, whole windows are dropped and the number of bus cycles\n");
+  tla_printf("skipped is shown.  Smaller windows show the latest activity sooner.\n");
 }
 
 void
-command_go(void)
+command_monitor(void)
 {
   if (argc != 1) {
-    help_go();
+    help_monitor();
+    return;
+  }
+  if (cpu_desc == NULL) {
+    tla_printf("No CPU type selected!\n");
     return;
   }
-  go();
+  monitor_run();
 }
 
 void
-help_list(void)
+help_count(void)
 {
-  tla_printf("usage: list [<start> [<end>]] - list samples\n");
-  tla_printf("\n<start> must be between 0 and the number of samples - 1 (curretly %d).\n",
-      samples - 1);
-  tla_printf("<end> must be between <start> and the number of samples - 1.\n");
-  tla_printf("\nType \"help samples\" for more information.\n");
+  tla_printf("usage: count                  - show the counter terms and counts\n");
+  tla_printf("       count add <condition>  - add a counter term\n");
+  tla_printf("       count clear            - remove all counter terms\n");
+  tla_printf("       count reset            - zero the counts\n");
+  tla_printf("       count run [<seconds>]  - count for <seconds>, or until Ctrl-C\n");
+  tla_printf("       count report <seconds> - report every <seconds> while counting (0 = never)\n");
+  tla_printf("\nThe counter watches the bus without storing samples, counting the bus\n");
+  tla_printf("cycles that match each term and the number of cycles between matches.\n");
+  tla_printf("Signal terms count the times the signal goes to the given level.\n");
+  tla_printf("Up to %d terms may be given; <condition> is written as for \"trigger\",\n",
+      COUNT_TERMS);
+  tla_printf("e.g. \"count add address C012 w\" or \"count add nmi 0\".\n");
 }
 
 void
-command_list(void)
+command_count(void)
 {
-  int start = 0;
-  int end = samples - 1;
+  struct match_spec ms;
   int n;
 
-  if (argc > 1) {
-    if (!parseDecimalNumber(argv[1], &n)) {
-      tla_printf("Invalid <start>.\n");
-      help_list();
+  if (argc == 1) {
+    count_report();
+    return;
+  }
+  if (stringMatch("add", argv[1]) > 0) {
+    if (countTermCount == COUNT_TERMS) {
+      tla_printf("Too many counter terms.\n");
       return;
     }
-    start = n;
+    memset(&ms, 0, sizeof(ms));
+    ms.cycle = tr_either;
+    if (!parse_match(2, &ms) || ms.mode == tr_none || ms.mode == tr_manual ||
+        ms.mode == tr_change || ms.mode == tr_illegal) {
+      help_count();
+      return;
+    }
+    memset(&countTerms[countTermCount], 0, sizeof(countTerms[0]));
+    countTerms[countTermCount++].spec = ms;
+    return;
   }
-  if (argc > 2) {
-    if (!parseDecimalNumber(argv[2], &n)) {
-      tla_printf("Invalid <end>.\n");
-      help_list();
+  if (argc == 2 && stringMatch("clear", argv[1]) > 0) {
+    countTermCount = 0;
+    count_reset();
+    return;
+  }
+  if (argc == 2 && stringMatch("reset", argv[1]) > 0) {
+    count_reset();
+    return;
+  }
+  if (argc == 3 && stringMatch("report", argv[1]) > 0) {
+    if (!parseDecimalNumber(argv[2], &n) || n < 0) {
+      help_count();
       return;
     }
-    end = n;
+    countReportInterval = n * 1000;
+    return;
   }
-  if (argc > 3) {
-    help_list();
+  if (argc <= 3 && stringMatch("run", argv[1]) > 0) {
+    n = 0;
+    if (argc == 3 && (!parseDecimalNumber(argv[2], &n) || n < 1)) {
+      help_count();
+      return;
+    }
+    if (cpu_desc == NULL) {
+      tla_printf("No CPU type selected!\n");
+      return;
+    }
+    if (countTermCount == 0) {
+      tla_printf("No counter terms.\n");
+      return;
+    }
+    count_run(n);
     return;
   }
-  if (start < 0 || start >= samples || end < start || end >= samples) {
-    tla_printf("Invalid samples range: must be between 0 and %d.\n", samples - 1);
+  help_count();
+}
+
+void
+help_watch(void)
+{
+  tla_printf("usage: watch                  - show the last values seen\n");
+  tla_printf("       watch <addr>...        - watch up to %d memory addresses until Ctrl-C\n", WATCH_SLOTS);
+  tla_printf("       watch io <port>...     - watch I/O ports instead\n");
+  tla_printf("       watch run              - watch the same addresses again\n");
+  tla_printf("\nThe last value read or written at each address is shown a few times a\n");
+  tla_printf("second when it changes, and the number of reads and writes is kept.\n");
+  tla_printf("Nothing is stored in the sample buffer, so it can run indefinitely.\n");
+}
+
+void
+command_watch(void)
+{
+  uint32_t addr;
+  space_t space = tr_mem;
+  int i, j, first = 1;
+
+  if (argc == 1) {
+    watch_show();
+    return;
+  }
+  if (cpu_desc == NULL) {
+    tla_printf("No CPU type selected!\n");
+    return;
+  }
+  if (argc == 2 && stringMatch("run", argv[1]) > 0) {
+    if (watchSlotCount == 0) {
+      tla_printf("Nothing to watch.\n");
+      return;
+    }
+    watch_run();
+    return;
+  }
+  if (stringMatch("io", argv[1]) > 0) {
+    if (!cpu_has_iospace(cpu)) {
+      tla_printf("%s does not have I/O space.\n", cpu_name());
+      return;
+    }
+    space = tr_io;
+    first = 2;
+  }
+  if (argc == first || argc - first > WATCH_SLOTS) {
+    help_watch();
     return;
   }
-  list(Serial, start, end, samplesTaken);
+  for (i = first; i < argc; i++) {
+    if (!parseAddress(argv[i], space, &addr)) {
+      return;
+    }
+  }
+
+  watchSpace = space;
+  watchSlotCount = 0;
+  for (i = first; i < argc; i++) {
+    parseAddress(argv[i], space, &addr);
+    for (j = 0; j < watchSlotCount && watchSlots[j].addr != addr; j++) {
+      ;
+    }
+    if (j == watchSlotCount) {
+      watchSlots[watchSlotCount++].addr = addr;
+    }
+  }
+  watch_run();
 }
 
 void
-help_export(void)
+help_hist(void)
 {
-  tla_printf("usage: export - export samples in CSV format\n");
+  tla_printf("usage: hist                             - show the ranges and results\n");
+  tla_printf("       hist add <first> <last> [<name>] - add an address range\n");
+  tla_printf("       hist clear                       - remove all ranges\n");
+  tla_printf("       hist reset                       - zero the results\n");
+  tla_printf("       hist run [<seconds>]             - run for <seconds>, or until Ctrl-C\n");
+  tla_printf("       hist report <seconds>            - report every <seconds> while running (0 = never)\n");
+  tla_printf("\nWhile running, every bus cycle is charged to the range containing the\n");
+  tla_printf("most recent opcode fetch (on the 6800 and 6809, which don't indicate\n");
+  tla_printf("fetches, to the range containing the cycle's own address).  Nothing is\n");
+  tla_printf("stored, so it can run indefinitely.  Up to %d ranges may be given;\n", HIST_RANGES);
+  tla_printf("where ranges overlap, the one added last wins.\n");
 }
 
 void
-command_export(void)
+command_hist(void)
 {
-  if (argc != 1) {
-    help_export();
+  struct hist_range *hr;
+  uint32_t first, last;
+  int n;
+
+  if (argc == 1) {
+    hist_report();
     return;
   }
-  exportCSV(Serial, samplesTaken);
+  if ((argc == 4 || argc == 5) && stringMatch("add", argv[1]) > 0) {
+    if (histRangeCount == HIST_RANGES) {
+      tla_printf("Too many ranges.\n");
+      return;
+    }
+    if (!parseAddress(argv[2], tr_mem, &first) ||
+        !parseAddress(argv[3], tr_mem, &last) || last < first) {
+      tla_printf("Invalid address range.\n");
+      return;
+    }
+    hr = &histRanges[histRangeCount++];
+    hr->first = first;
+    hr->last = last;
+    if (argc == 5) {
+      snprintf(hr->name, sizeof(hr->name), "%s", argv[4]);
+    } else {
+      snprintf(hr->name, sizeof(hr->name), "range %d", histRangeCount);
+    }
+    return;
+  }
+  if (argc == 2 && stringMatch("clear", argv[1]) > 0) {
+    histRangeCount = 0;
+    hist_reset();
+    return;
+  }
+  if (argc == 2 && stringMatch("reset", argv[1]) > 0) {
+    hist_reset();
+    return;
+  }
+  if (argc == 3 && stringMatch("report", argv[1]) > 0) {
+    if (!parseDecimalNumber(argv[2], &n) || n < 0) {
+      help_hist();
+      return;
+    }
+    histReportInterval = n * 1000;
+    return;
+  }
+  if (argc <= 3 && stringMatch("run", argv[1]) > 0) {
+    n = 0;
+    if (argc == 3 && (!parseDecimalNumber(argv[2], &n) || n < 1)) {
+      help_hist();
+      return;
+    }
+    if (cpu_desc == NULL) {
+      tla_printf("No CPU type selected!\n");
+      return;
+    }
+    hist_run(n);
+    return;
+  }
+  help_hist();
 }
 
 void
-help_write(void)
+help_mix(void)
 {
-  tla_printf("usage: write - write data to SD card\n");
-  tla_printf("\nThe file \"analyzer.csv\" will contain the sample data in CSV format.\n");
-  tla_printf("The file \"analyzer.txt\" will contain the sample data in \"list\" format.\n");
+  tla_printf("usage: mix      - show the most frequent instructions in the sample data\n");
+  tla_printf("       mix all  - show all of them\n");
+  tla_printf("\nInstructions are counted by mnemonic and addressing mode (e.g. \"LDA $nnnn\"),\n");
+  tla_printf("and then by mnemonic alone.\n");
 }
 
 void
-command_write(void)
+command_mix(void)
 {
-  if (argc != 1) {
-    help_write();
+  if (argc == 1) {
+    mix_report(16);
+  } else if (argc == 2 && stringMatch("all", argv[1]) > 0) {
+    mix_report(0);
+  } else {
+    help_mix();
+  }
+}
+
+void
+help_static(void)
+{
+  tla_printf("usage: static              - show the size of the static listing\n");
+  tla_printf("       static add          - add the instructions in the sample data\n");
+  tla_printf("       static list         - list the code executed, in address order\n");
+  tla_printf("       static save <file>  - write the listing to SD\n");
+  tla_printf("       static clear        - start a new static listing\n");
+  tla_printf("\nThe static listing accumulates every distinct instruction executed in\n");
+  tla_printf("the captures added to it, with how many times each was executed.\n");
+  tla_printf("Addresses that execution jumped to are labelled.\n");
+}
+
+void
+command_static(void)
+{
+  if (argc == 1) {
+    tla_printf("Static listing: %d instructions from %lu captures\n",
+        codeEntries, codeCaptures);
+  } else if (argc == 2 && stringMatch("add", argv[1]) > 0) {
+    code_add();
+  } else if (argc == 2 && stringMatch("list", argv[1]) > 0) {
+    if (cpu_desc == NULL) {
+      tla_printf("No CPU type selected!\n");
+      return;
+    }
+    code_list(Serial);
+  } else if (argc == 2 && stringMatch("clear", argv[1]) > 0) {
+    code_clear();
+  } else if (argc == 3 && stringMatch("save", argv[1]) > 0) {
+    if (cpu_desc == NULL) {
+      tla_printf("No CPU type selected!\n");
+      return;
+    }
+    if (!SD.begin(BUILTIN_SDCARD)) {
+      tla_printf("Unable to initialize internal SD card.\n");
+      return;
+    }
+    if (SD.exists(argv[2])) {
+      SD.remove(argv[2]);
+    }
+    File file = SD.open(argv[2], FILE_WRITE);
+    if (!file) {
+      tla_printf("Unable to write %s\n", argv[2]);
+      return;
+    }
+    tla_printf("Writing %s\n", argv[2]);
+    code_list(file);
+    file.close();
+  } else {
+    help_static();
+  }
+}
+
+void
+help_trace(void)
+{
+  tla_printf("usage: trace        - show the branch trace statistics\n");
+  tla_printf("       trace go     - record a branch trace\n");
+  tla_printf("       trace list   - list the reconstructed instruction trace\n");
+  tla_printf("\nA branch trace only records opcode fetches that don't follow on from\n");
+  tla_printf("the previous instruction (branches, jumps, calls, returns, interrupts)\n");
+  tla_printf("and write cycles, so the sample buffer covers many more bus cycles.\n");
+  tla_printf("The instructions in between are reconstructed from the memory image\n");
+  tla_printf("(see \"image\").  Recording starts at the trigger; pretrigger must be 0.\n");
+}
+
+void
+command_trace(void)
+{
+  if (argc == 1) {
+    trace_show();
     return;
   }
-  writeSD();
+  if (argc == 2 && stringMatch("go", argv[1]) > 0) {
+    if (cpu_desc == NULL) {
+      tla_printf("No CPU type selected!\n");
+      return;
+    }
+    if (cpu_desc->fetch_mask == 0) {
+      tla_printf("The %s doesn't indicate opcode fetches; can't trace it.\n",
+          cpu_desc->name);
+      return;
+    }
+    if (pretrigger != 0) {
+      tla_printf("Pretrigger must be 0 for a branch trace.\n");
+      return;
+    }
+    trace_go();
+    return;
+  }
+  if (argc == 2 && stringMatch("list", argv[1]) > 0) {
+    trace_list(Serial);
+    return;
+  }
+  help_trace();
 }
 
 void
-help_decode(void)
+help_image(void)
 {
-  tla_printf("usage: decode <addr> - decode a single instruction at <addr>\n");
-  tla_printf("\n<addr> must be between 0 and FFFF and must be present in the sample data.\n");
+  tla_printf("usage: image                       - show the memory image address ranges\n");
+  tla_printf("       image load <file> [<addr>]  - load a file from SD\n");
+  tla_printf("       image receive [<addr>]      - receive Intel HEX on the console\n");
+  tla_printf("       image verify                - check the recorded reads against the image\n");
+  tla_printf("       image clear                 - clear the memory image\n");
+  tla_printf("\nThe memory image holds known contents of the target's memory, e.g. its\n");
+  tla_printf("ROM.  It is used to fill in instruction bytes that weren't captured, and\n");
+  tla_printf("listed reads that don't match it are marked MISMATCH.\n");
+  tla_printf("\nFiles named *.hex or *.ihx are Intel HEX, offset by <addr>; anything else\n");
+  tla_printf("is a binary image loaded at <addr>.  <addr> defaults to 0.  Paste HEX\n");
+  tla_printf("records after \"image receive\"; it ends at the end of file record or Ctrl-C.\n");
 }
 
 void
-command_decode(void)
+command_image(void)
 {
-  if (argc != 2) {
-    help_decode();
+  uint32_t addr = 0;
+  long n;
+
+  if (argc == 1) {
+    mem_image_show();
     return;
   }
-  uint32_t pc;
-  if (parseAddress(argv[1], tr_mem, &pc)) {
-    disassemble_one(pc);
+  if (argc == 2 && stringMatch("clear", argv[1]) > 0) {
+    memset(memImageValid, 0, sizeof(memImageValid));
+    list_reset();
+    return;
+  }
+  if (argc == 2 && stringMatch("verify", argv[1]) > 0) {
+    mem_image_verify();
+    return;
+  }
+  if ((argc == 2 || argc == 3) && stringMatch("receive", argv[1]) > 0) {
+    if (argc == 3 && !parseAddress(argv[2], tr_mem, &addr)) {
+      help_image();
+      return;
+    }
+    tla_printf("Send Intel HEX records; Ctrl-C to cancel.\n");
+    n = mem_image_load_ihex(Serial, true, addr);
+    if (n >= 0) {
+      tla_printf("Loaded %ld bytes\n", n);
+    }
+    list_reset();
+    return;
+  }
+  if ((argc == 3 || argc == 4) && stringMatch("load", argv[1]) > 0) {
+    if (argc == 4 && !parseAddress(argv[3], tr_mem, &addr)) {
+      help_image();
+      return;
+    }
+    n = mem_image_load(argv[2], addr);
+    if (n >= 0) {
+      tla_printf("Loaded %ld bytes\n", n);
+    }
+    list_reset();
+    return;
+  }
+  help_image();
+}
+
+void
+help_bench(void)
+{
+  tla_printf("usage: bench sd   - time writing and reading the SD card\n");
+  tla_printf("       bench usb  - time writing to the console\n");
+  tla_printf("\nEach writes a payload the size of a full listing in %d, %d and %d byte\n",
+      benchBlockSizes[0], benchBlockSizes[1], benchBlockSizes[2]);
+  tla_printf("blocks, and reports MB/s and the longest stall.  The results are also\n");
+  tla_printf("added to \"%s\" on the SD card.  \"bench usb\" fills the terminal with\n", BENCH_RESULTS);
+  tla_printf("text; run it with the output going somewhere fast.\n");
+}
+
+void
+command_bench(void)
+{
+  if (argc == 2 && stringMatch("sd", argv[1]) > 0) {
+    bench_sd();
+  } else if (argc == 2 && stringMatch("usb", argv[1]) > 0) {
+    bench_usb();
   } else {
-    help_decode();
+    help_bench();
+  }
+}
+
+#if defined(TLA_PERF)
+void
+help_perf(void)
+{
+  tla_printf("usage: perf        - show the firmware performance counters\n");
+  tla_printf("       perf reset  - zero them\n");
+  tla_printf("\nTimes come from the CPU cycle counter.  Capture is timed from the\n");
+  tla_printf("trigger on, so its time per sample is the shortest bus cycle it can keep\n");
+  tla_printf("up with.  Decode is timed per instruction byte, and includes the\n");
+  tla_printf("counters' own overhead.\n");
+}
+
+void
+command_perf(void)
+{
+  if (argc == 1) {
+    perf_report();
+  } else if (argc == 2 && stringMatch("reset", argv[1]) > 0) {
+    memset(perf_counters, 0, sizeof(perf_counters));
+  } else {
+    help_perf();
   }
 }
+#endif // TLA_PERF
 
 #ifdef DEBUG_SAMPLES
 void
 command_loadtest(void)
 {
   samples = samplesTaken = sizeof(debug_data) / sizeof(debug_data[0]);
-  cpu = DEBUG_CPU;
+  set_cpu(DEBUG_CPU);
   memcpy(data, debug_data, sizeof(debug_data));
   memcpy(address, debug_address, sizeof(debug_address));
   memcpy(control, debug_control, sizeof(debug_control));
@@ -1958,6 +6677,9 @@ command_loadtest(void)
   triggerPoint = DEBUG_TRIGGER_POINT;
   pretrigger = DEBUG_TRIGGER_POINT;
 #endif  // DEBUG_TRIGGER_POINT
+  classify_cycles();
+  list_reset();
+  captureMode = cm_samples;
 }
 #endif // DEBUG_SAMPLES
 
@@ -1975,14 +6697,39 @@ const struct tla_command {
   { "trigger",    command_trigger,    help_trigger,     "Set trigger mode" },
   { "go",         command_go,         help_go,          "Go - start analyzer" },
   { "list",       command_list,       help_list,        "List samples" },
+  { "next",       command_next,       help_next,        "List next page" },
+  { "prev",       command_prev,       help_prev,        "List previous page" },
+  { "goto",       command_goto,       help_goto,        "Move listing to trigger/sample/address" },
   { "export",     command_export,     help_export,      "Export samples as CSV" },
   { "write",      command_write,      help_write,       "Write data to SD card" },
   { "decode",     command_decode,     help_decode,      "Decode instruction" },
+  { "soak",       command_soak,       help_soak,        "Capture repeatedly, gathering statistics" },
+  { "monitor",    command_monitor,    help_monitor,     "Show executed instructions live" },
+  { "count",      command_count,      help_count,       "Count events without storing samples" },
+  { "hist",       command_hist,       help_hist,        "Address-range time histogram" },
+  { "watch",      command_watch,      help_watch,       "Watch values at memory addresses" },
+  { "trace",      command_trace,      help_trace,       "Branch trace capture" },
+  { "mix",        command_mix,        help_mix,         "Instruction mix statistics" },
+  { "static",     command_static,     help_static,      "Static listing of executed code" },
+  { "image",      command_image,      help_image,       "Load memory image" },
+  { "bench",      command_bench,      help_bench,       "SD card and USB throughput benchmarks" },
+#if defined(TLA_PERF)
+  { "perf",       command_perf,       help_perf,        "Firmware performance counters" },
+#endif
 #ifdef DEBUG_SAMPLES
   { "loadtest",   command_loadtest,   NULL,             "Load test samples" },
 #endif
   { "help",       command_help,       NULL,             "Show help" },
   { "?",          command_help,       NULL },
+  { "c",          command_cpu,        help_cpu },
+  { "g",          command_go,         help_go },
+  { "n",          command_next,       help_next },
+  { "p",          command_prev,       help_prev },
+  { "h",          command_help,       NULL },
+  { "t",          command_trigger,    help_trigger },
+  { "tr",         command_trigger,    help_trigger },
+  { "s",          command_samples,    help_samples },
+  { "w",          command_write,      help_write },
 
   { NULL },
 };
@@ -2002,6 +6749,21 @@ lookupCommand(const char *cp, const struct tla_command *from)
   return NULL;
 }
 
+// An exact match wins over any abbreviations, so that short aliases
+// like "p" don't collide with longer commands like "pretrigger".
+const struct tla_command *
+lookupExactCommand(const char *cp)
+{
+  const struct tla_command *cmd;
+
+  for (cmd = cmdtab; cmd->cmdstr != NULL; cmd++) {
+    if (strcmp(cmd->cmdstr, cp) == 0) {
+      return cmd;
+    }
+  }
+  return NULL;
+}
+
 void
 command_help(void)
 {
@@ -2012,7 +6774,10 @@ command_help(void)
   // help message.
 
   if (argc > 1) {
-    const struct tla_command * const cmd = lookupCommand(argv[1], NULL);
+    const struct tla_command *cmd = lookupExactCommand(argv[1]);
+    if (cmd == NULL) {
+      cmd = lookupCommand(argv[1], NULL);
+    }
     if (cmd != NULL && cmd->helpfunc != NULL) {
       (*cmd->helpfunc)();
       return;
@@ -2106,7 +6871,7 @@ loop(void)
           continue;
         }
       }
-      if (c != -1 && ci <= CMDBUF_LEN - 1) {
+      if (c != -1 && ci < CMDBUF_LEN - 1) {
         Serial.write((char)c);  // Echo character
         cmdbuf[ci++] = (char)c; // Append to command string
       }
@@ -2124,8 +6889,8 @@ loop(void)
       continue;
     }
 
-    foundcmd = NULL;
-    if ((cmd = lookupCommand(argv[0], NULL)) != NULL) {
+    foundcmd = lookupExactCommand(argv[0]);
+    if (foundcmd == NULL && (cmd = lookupCommand(argv[0], NULL)) != NULL) {
       if (foundcmd == NULL) {
         foundcmd = cmd;
         cmd = lookupCommand(argv[0], foundcmd + 1);
@@ -2137,6 +6902,7 @@ loop(void)
     }
     if (foundcmd == NULL) {
       invalidCommand();
+      continue;
     }
     foundcmd->cmdfunc();
   }
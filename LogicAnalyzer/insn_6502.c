@@ -46,7 +46,8 @@
 //        decimal representation.  This will also cause us to calculate
 //        the resolved address.
 //
-static const char *opcodes_65c02[256] = {
+#define OPCODE_LEN_6502 12     // longest template + 1
+static const char opcodes_65c02[256][OPCODE_LEN_6502] TLA_FLASH = {
   "BRK",       "ORA ($nn,X)", "?",         "?",   "TSB $nn",     "ORA $nn",     "ASL $nn",     "RMB0 $nn",
   "PHP",       "ORA #$nn",    "ASLA",      "?",   "TSB $nnnn",   "ORA $nnnn",   "ASL $nnnn",   "BBR0 $nn",
   "BPL rrrr",  "ORA ($nn),Y", "ORA ($nn)", "?",   "TRB $nn",     "ORA $nn,X",   "ASL $nn,X",   "RMB1 $nn",
@@ -81,7 +82,7 @@ static const char *opcodes_65c02[256] = {
   "SED",       "SBC $nnnn,Y", "PLX",       "?",   "?",           "SBC $nnnn,X", "INC $nnnn,X", "BBS7 $nn"
 };
 
-static const char *opcodes_6502[256] = {
+static const char opcodes_6502[256][OPCODE_LEN_6502] TLA_FLASH = {
   "BRK",       "ORA ($nn,X)", "?",        "?", "?",           "ORA $nn",     "ASL $nn",     "?",
   "PHP",       "ORA #$nn",    "ASLA",     "?", "?",           "ORA $nnnn",   "ASL $nnnn",   "?",
   "BPL rrrr",  "ORA ($nn),Y", "?",        "?", "?",           "ORA $nn,X",   "ASL $nn,X",   "?",
@@ -119,9 +120,9 @@ static const char *opcodes_6502[256] = {
 static void
 insn_decode_format_6502(struct insn_decode *id)
 {
-  const char **opcodes = (cpu == cpu_65c02) ? opcodes_65c02 : opcodes_6502;
+  const char (*opcodes)[OPCODE_LEN_6502] = (cpu == cpu_65c02) ? opcodes_65c02 : opcodes_6502;
   char *cp, op[5];
-  int16_t val;
+  int val;
 
   strcpy(id->insn_string, opcodes[id->bytes[0]]);
 
@@ -165,7 +166,7 @@ insn_decode_next_state_6502(struct insn_decode *id)
   }
 
   if (id->bytes_required == 0) {
-    const char **opcodes = (cpu == cpu_65c02) ? opcodes_65c02 : opcodes_6502;
+    const char (*opcodes)[OPCODE_LEN_6502] = (cpu == cpu_65c02) ? opcodes_65c02 : opcodes_6502;
     const char *cp1 = opcodes[id->bytes[0]];
 
     if (strstr(cp1, "nnnn") != NULL) {
@@ -190,3 +191,11 @@ insn_decode_next_state_6502(struct insn_decode *id)
     id->state = ds_complete;
   }
 }
+
+void
+insn_decode_illegal_6502(uint8_t *map)
+{
+  const char (*opcodes)[OPCODE_LEN_6502] = (cpu == cpu_65c02) ? opcodes_65c02 : opcodes_6502;
+
+  insn_decode_illegal_map(map, opcodes[0], sizeof(opcodes[0]));
+}
@@ -28,7 +28,7 @@
 //
 // 6800 instruction decoding
 //
-static const char *opcodes_6800[256] = {
+static const char opcodes_6800[256][5] TLA_FLASH = {
   "?",    "NOP",  "?",    "?",    "?",    "?",    "TAP",  "TPA",
   "INX",  "DEX",  "CLV",  "SEV",  "CLC",  "SEC",  "CLI",  "SEI",
   "SBA",  "CBA",  "?",    "?",    "?",    "?",    "TAB",  "TBA",
@@ -203,3 +203,9 @@ insn_decode_next_state_6800(struct insn_decode *id)
     id->state = ds_complete;
   }
 }
+
+void
+insn_decode_illegal_6800(uint8_t *map)
+{
+  insn_decode_illegal_map(map, opcodes_6800[0], sizeof(opcodes_6800[0]));
+}
@@ -63,7 +63,7 @@ static insn_postbytes_6809[] = {
 };
 #undef POSTBYTES
 
-static const char *opcodes_6809[256] = {
+static const char opcodes_6809[256][6] TLA_FLASH = {
   "NEG",  "?",    "?",    "COM",  "LSR",  "?",    "ROR",  "ASR",
   "ASL",  "ROL",  "DEC",  "?",    "INC",  "TST",  "JMP",  "CLR",
   "(pg2)","(pg3)","NOP",  "SYNC", "?",    "?",    "LBRA", "LBSR",
@@ -98,7 +98,7 @@ static const char *opcodes_6809[256] = {
   "EORB", "ADCB", "ORB",  "ADDB", "LDD",  "STD",  "LDU",  "STU"
 };
 
-static const char *opcodes_long_cond_branches_6809[] = {
+static const char opcodes_long_cond_branches_6809[][5] TLA_FLASH = {
   "?",    "LBRN", "LBHI", "LBLS", "LBCC", "LBCS", "LBNE", "LBEQ",
   "LBVC", "LBVS", "LBPL", "LBMI", "LBGE", "LBLT", "LBGT", "LBLE"
 };
@@ -624,3 +624,10 @@ insn_decode_next_state_6809(struct insn_decode *id)
     id->state = ds_complete;
   }
 }
+
+// The page 2 and 3 prefixes are legal; what follows them isn't checked.
+void
+insn_decode_illegal_6809(uint8_t *map)
+{
+  insn_decode_illegal_map(map, opcodes_6809[0], sizeof(opcodes_6809[0]));
+}
@@ -25,45 +25,60 @@
 #include "tla.h"
 #include "insn_decode.h"
 
+static struct insn_decode_cache insn_decode_cache[INSN_DECODE_CACHE_SIZE];
+uint32_t insn_decode_cache_hits;
+uint32_t insn_decode_cache_misses;
+
 void
-insn_decode_init(struct insn_decode *id)
+insn_decode_init(struct insn_decode *id, void (*next_state)(struct insn_decode *))
 {
   id->state = ds_idle;
-  switch (cpu) {
-    case cpu_6502:
-    case cpu_65c02:
-      id->next_state = insn_decode_next_state_6502;
-      break;
-
-    case cpu_6800:
-      id->next_state = insn_decode_next_state_6800;
-      break;
-
-    case cpu_6809:
-    case cpu_6809e:
-      id->next_state = insn_decode_next_state_6809;
-      break;
-
-    case cpu_z80:
-      id->next_state = insn_decode_next_state_z80;
-      break;
-
-    default:
-      id->next_state = NULL;
-  }
+  id->next_state = next_state;
+  id->cached = NULL;
+  id->use_cache = true;
+}
+
+void
+insn_decode_init_uncached(struct insn_decode *id, void (*next_state)(struct insn_decode *))
+{
+  insn_decode_init(id, next_state);
+  id->use_cache = false;
+}
+
+static struct insn_decode_cache *
+insn_decode_cache_slot(uint32_t addr)
+{
+  return &insn_decode_cache[addr & (INSN_DECODE_CACHE_SIZE - 1)];
 }
 
 static bool
 insn_decode_next_state(struct insn_decode *id)
 {
   decode_state_t ostate = id->state;
+  struct insn_decode_cache *ce;
 
   if (id->next_state != NULL) {
     (*id->next_state)(id);
     if (ostate == ds_fetching) {
-      if (id->state == ds_complete && id->resolved_address_valid) {
-        char *cp = &id->insn_string[strlen(id->insn_string)];
-        sprintf(cp, " <%04lX>", id->resolved_address);
+      if (id->state == ds_complete) {
+        if (id->resolved_address_valid) {
+          char *cp = &id->insn_string[strlen(id->insn_string)];
+          sprintf(cp, " <%04lX>", id->resolved_address);
+        }
+        if (!id->use_cache) {
+          return true;
+        }
+        ce = insn_decode_cache_slot(id->insn_address);
+        ce->cpu = cpu;
+        ce->next_state = id->next_state;
+        ce->insn_address = id->insn_address;
+        ce->resolved_address = id->resolved_address;
+        ce->resolved_address_valid = id->resolved_address_valid;
+        ce->addrmode = id->addrmode;
+        ce->bytes_fetched = id->bytes_fetched;
+        memcpy(ce->bytes, id->bytes, id->bytes_fetched);
+        strcpy(ce->insn_string, id->insn_string);
+        insn_decode_cache_misses++;
       }
       return true;
     }
@@ -71,11 +86,56 @@ insn_decode_next_state(struct insn_decode *id)
   return false;
 }
 
+// Does the cache entry still match what id has fetched so far?  The
+// entry can be replaced by another decode while id is in progress.
+static bool
+insn_decode_cache_match(const struct insn_decode_cache *ce, const struct insn_decode *id)
+{
+  return ce->bytes_fetched >= id->bytes_fetched &&
+         ce->insn_address == id->insn_address &&
+         ce->cpu == cpu && ce->next_state == id->next_state &&
+         memcmp(ce->bytes, id->bytes, id->bytes_fetched) == 0;
+}
+
+// The bytes so far match the cache entry; complete the instruction
+// from it if they're all there.
+static void
+insn_decode_cache_next_state(struct insn_decode *id)
+{
+  const struct insn_decode_cache *ce = id->cached;
+
+  if (id->bytes_fetched == ce->bytes_fetched) {
+    id->resolved_address = ce->resolved_address;
+    id->resolved_address_valid = ce->resolved_address_valid;
+    id->addrmode = ce->addrmode;
+    strcpy(id->insn_string, ce->insn_string);
+    id->state = ds_complete;
+    id->cached = NULL;
+    insn_decode_cache_hits++;
+  }
+}
+
+// The latest byte doesn't match the cache entry after all; run the
+// decoder over the bytes from the beginning.
+static void
+insn_decode_cache_miss(struct insn_decode *id)
+{
+  int i, n = id->bytes_fetched;
+
+  id->cached = NULL;
+  id->bytes_fetched = 0;
+  for (i = 0; i < n && id->state == ds_fetching; i++) {
+    id->bytes_fetched++;
+    insn_decode_next_state(id);
+  }
+}
+
 void
 insn_decode_begin(struct insn_decode *id, uint32_t addr, uint8_t b)
 {
   if (id->next_state != NULL &&
       (id->state == ds_idle || id->state == ds_complete)) {
+    PERF_BEGIN(perf);
     id->state = ds_fetching;
     id->insn_address = addr;
     id->resolved_address = 0;
@@ -84,7 +144,16 @@ insn_decode_begin(struct insn_decode *id, uint32_t addr, uint8_t b)
     id->bytes_required = 0;
     id->bytes_fetched = 0;
     id->bytes[id->bytes_fetched++] = b;
-    insn_decode_next_state(id);
+
+    struct insn_decode_cache *ce = insn_decode_cache_slot(addr);
+    if (id->use_cache && insn_decode_cache_match(ce, id)) {
+      id->cached = ce;
+      insn_decode_cache_next_state(id);
+    } else {
+      id->cached = NULL;
+      insn_decode_next_state(id);
+    }
+    PERF_END(pf_decode, perf, 1);
   }
 }
 
@@ -94,13 +163,24 @@ insn_decode_continue(struct insn_decode *id, uint8_t b)
   bool was_fetching = false;
 
   if (id->state == ds_fetching) {
+    PERF_BEGIN(perf);
     if (id->bytes_fetched == INSN_DECODE_MAXBYTES) {
       strcpy(id->insn_string, "<decode overflow>");
       id->state = ds_complete;
     } else {
       id->bytes[id->bytes_fetched++] = b;
-      was_fetching = insn_decode_next_state(id);
+      if (id->cached == NULL) {
+        was_fetching = insn_decode_next_state(id);
+      } else {
+        if (insn_decode_cache_match(id->cached, id)) {
+          insn_decode_cache_next_state(id);
+        } else {
+          insn_decode_cache_miss(id);
+        }
+        was_fetching = true;
+      }
     }
+    PERF_END(pf_decode, perf, 1);
   }
   return was_fetching;
 }
@@ -113,3 +193,18 @@ insn_decode_complete(struct insn_decode *id)
   }
   return "";
 }
+
+// Fill in an illegal opcode map from a 256-entry opcode table with
+// rows of rowlen characters.
+void
+insn_decode_illegal_map(uint8_t *map, const char *table, size_t rowlen)
+{
+  int op;
+
+  memset(map, 0, INSN_ILLEGAL_MAP_SIZE);
+  for (op = 0; op < 256; op++) {
+    if (strcmp(&table[op * rowlen], "?") == 0) {
+      map[op >> 3] |= 1U << (op & 7);
+    }
+  }
+}
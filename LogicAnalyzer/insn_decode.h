@@ -136,6 +136,7 @@ typedef enum {
 typedef enum { ds_idle, ds_fetching, ds_complete } decode_state_t;
 #define INSN_DECODE_MAXBYTES    8
 #define INSN_DECODE_MAXSTRING   28  // See also printf format in list().
+struct insn_decode_cache;
 struct insn_decode {
   decode_state_t      state;
   uint32_t            insn_address;
@@ -147,6 +148,30 @@ struct insn_decode {
   addrmode_t          addrmode;
   uint8_t             bytes[INSN_DECODE_MAXBYTES];
   char                insn_string[INSN_DECODE_MAXSTRING];
+  struct insn_decode_cache *cached;   // matching cache entry so far
+  bool                use_cache;
+};
+
+//
+// Decode cache.  Listings are dominated by loops, so the same instruction
+// at the same address gets decoded over and over.  Completed decodes are
+// remembered in a small direct-mapped cache keyed by address; a fetch
+// that hits is checked against the cached bytes as they arrive and, if
+// they all match, completed without running the decoder at all.
+// Decodes of made-up or speculative bytes use insn_decode_init_uncached(),
+// so they don't evict real entries or count in the hit and miss totals.
+//
+#define INSN_DECODE_CACHE_SIZE  64  // Must be a power of 2.
+struct insn_decode_cache {
+  cpu_t               cpu;
+  void                (*next_state)(struct insn_decode *);
+  uint32_t            insn_address;
+  uint32_t            resolved_address;
+  bool                resolved_address_valid;
+  addrmode_t          addrmode;
+  int                 bytes_fetched;  // 0 if the entry is unused
+  uint8_t             bytes[INSN_DECODE_MAXBYTES];
+  char                insn_string[INSN_DECODE_MAXSTRING];
 };
 
 //
@@ -181,16 +206,28 @@ read_s16be(const uint8_t *buf, int i)
 extern "C" {
 #endif
 
-void insn_decode_init(struct insn_decode *);
+void insn_decode_init(struct insn_decode *, void (*)(struct insn_decode *));
+void insn_decode_init_uncached(struct insn_decode *, void (*)(struct insn_decode *));
 void insn_decode_begin(struct insn_decode *, uint32_t, uint8_t);
 bool insn_decode_continue(struct insn_decode *, uint8_t);
 const char *insn_decode_complete(struct insn_decode *);
 
+extern uint32_t insn_decode_cache_hits;
+extern uint32_t insn_decode_cache_misses;
+
 void insn_decode_next_state_6502(struct insn_decode *);
 void insn_decode_next_state_6800(struct insn_decode *);
 void insn_decode_next_state_6809(struct insn_decode *);
 void insn_decode_next_state_z80(struct insn_decode *);
 
+// Opcodes the decoders don't know ("?" in their tables), as a bitmap of
+// 256 bits.
+#define INSN_ILLEGAL_MAP_SIZE   (256 / 8)
+void insn_decode_illegal_map(uint8_t *, const char *, size_t);
+void insn_decode_illegal_6502(uint8_t *);
+void insn_decode_illegal_6800(uint8_t *);
+void insn_decode_illegal_6809(uint8_t *);
+
 #if defined(__cplusplus)
 }
 #endif
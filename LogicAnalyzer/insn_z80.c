@@ -28,7 +28,7 @@
 //
 // Z80 instruction decoding
 //
-static const char *opcodes_z80[256] = {
+static const char opcodes_z80[256][14] TLA_FLASH = {
   "NOP",          "LD BC,XXXXh",  "LD (BC),A",    "INC BC",       "INC B",        "DEC B",        "LD B,XXh",     "RLCA",
   "EX AF,AF'",    "ADD HL,BC",    "LD A,(BC)",    "DEC BC",       "INC C",        "DEC C",        "LD C,XXh",     "RRCA",
   "DJNZ rrrr",    "LD DE,XXXXh",  "LD (DE),A",    "INC DE",       "INC D",        "DEC D",        "LD D,XXh",     "RLA",
@@ -267,7 +267,7 @@ z80_insn_template(struct insn_decode *id)
       ((opc == 0xdd || opc == 0xfd) && id->bytes_fetched >= 2 && id->bytes[1] == 0xcb)) {
     // This group is a handful of instruction additions.  We also handle
     // the DD and FD group subsitutions for these instructions.
-    static const char *opcodes_CB[32] = {
+    static const char opcodes_CB[32][7] TLA_FLASH = {
       "RLC ",   "RRC ",   "RL ",    "RR ",    "SLA ",   "SRA ",   "? ",     "SRL ",
       "BIT 0,", "BIT 1,", "BIT 2,", "BIT 3,", "BIT 4,", "BIT 5,", "BIT 6,", "BIT 7,",
       "RES 0,", "RES 1,", "RES 2,", "RES 3,", "RES 4,", "RES 5,", "RES 6,", "RES 7,",
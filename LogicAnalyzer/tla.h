@@ -34,12 +34,45 @@
 #include <string.h>
 #include <stdio.h>
 
+// Constant tables that should stay in flash.  On the Teensy 4, const
+// data is otherwise copied into RAM1 at startup, and so are the string
+// literals that a table of pointers points at.
+#if defined(__IMXRT1062__)
+#define TLA_FLASH   __attribute__((__section__(".progmem")))
+#else
+#define TLA_FLASH
+#endif
+
 // Trigger and CPU type definitions
-typedef enum { tr_address, tr_data, tr_addr_data, tr_reset, tr_irq, tr_firq, tr_nmi, tr_manual, tr_none } trigger_t;
+typedef enum { tr_address, tr_data, tr_addr_data, tr_reset, tr_irq, tr_firq, tr_nmi, tr_manual, tr_none, tr_change, tr_illegal } trigger_t;
 typedef enum { tr_mem, tr_io } space_t;
 typedef enum { tr_read, tr_write, tr_either } cycle_t;
+typedef enum { to_off, to_high, to_low } trigger_out_t;
+
+// Trigger program instructions (see trig_step()).
+typedef enum { tp_match, tp_skip_unless, tp_inc, tp_ge, tp_end, tp_goto, tp_fire, tp_change, tp_illegal } trig_op_t;
 typedef enum { cpu_none = -1, cpu_6502 = 0, cpu_65c02 = 1, cpu_6800 = 2, cpu_6809 = 3, cpu_6809e = 4, cpu_z80 = 5 } cpu_t;
 
+// Bus cycle types, as determined by the per-CPU cycle classifiers.
+// These are stored 4 bits per sample, so there can be at most 16.
+typedef enum { bc_none, bc_fetch, bc_read, bc_write, bc_dummy, bc_io_read, bc_io_write, bc_vector } bus_cycle_t;
+
+// CSV export column types.
+typedef enum { ec_index, ec_trigger, ec_signal, ec_address, ec_data, ec_cycle, ec_insn, ec_repeat } export_col_t;
+
+// What the sample buffer holds: consecutive bus cycles, a branch
+// trace, a write log or compressed bus cycles.
+typedef enum { cm_samples, cm_trace, cm_writes, cm_compressed } capture_mode_t;
+
+// Soak mode archive predicates.
+typedef enum { sa_none, sa_all, sa_anomaly, sa_coverage, sa_latency } soak_archive_t;
+
+// Firmware performance counters, for timing the analyzer's own work
+// (see the "perf" command).  Uncomment TLA_PERF to build them in; when
+// it isn't defined, PERF_BEGIN and PERF_END compile to nothing.
+// #define TLA_PERF
+typedef enum { pf_arm, pf_capture, pf_unscramble, pf_classify, pf_list, pf_export, pf_write_sd, pf_decode, pf_count } perf_t;
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -48,6 +81,25 @@ extern cpu_t cpu;
 
 int tla_printf(const char *, ...) __attribute__((__format__(__printf__, 1, 2)));
 
+#if defined(TLA_PERF)
+struct perf_counter {
+  uint32_t  calls;
+  uint32_t  max;                      // longest call, in CPU cycles
+  uint64_t  cycles;
+  uint64_t  items;                    // samples, lines or bytes handled
+};
+extern struct perf_counter perf_counters[pf_count];
+
+uint32_t perf_cycles(void);
+void perf_end(perf_t, uint32_t, uint32_t);
+
+#define PERF_BEGIN(t)           uint32_t t = perf_cycles()
+#define PERF_END(p, t, items)   perf_end((p), (t), (items))
+#else
+#define PERF_BEGIN(t)           do { } while (0)
+#define PERF_END(p, t, items)   do { } while (0)
+#endif
+
 #if defined(__cplusplus)
 }
 #endif